@@ -14,6 +14,29 @@
 // maximum size of block that must be accommodated
 #define MAX_REQUEST_SIZE (1 << 30)
 
+// number of buckets in the free block histogram of struct heap_stats
+#define HEAP_STATS_BUCKETS 40
+
+// A snapshot of the heap, filled in by myheap_stats. Sizes are payload
+// bytes, so they include rounding but not headers.
+struct heap_stats {
+    size_t heap_bytes;      // memory the heap has committed or mapped
+    size_t live_bytes;      // bytes in blocks in use
+    size_t free_bytes;      // bytes in free blocks
+    size_t live_blocks;
+    size_t free_blocks;
+    size_t largest_free;    // size of the largest free block
+    // free blocks counted by floor(log2(size)), the last bucket takes
+    // all bigger ones
+    size_t free_histogram[HEAP_STATS_BUCKETS];
+    double fragmentation;   // 1 - largest_free / free_bytes, 0 if nothing is free
+    // work done since myinit, only counted by the explicit allocator
+    size_t splits;          // free blocks split to fit a request
+    size_t coalesces;       // free blocks merged with a free neighbour
+    size_t quick_allocs;    // requests served from a quick list
+    size_t quick_frees;     // frees put on a quick list without coalescing
+};
+
 
 
 /* Function: myinit
@@ -48,6 +71,48 @@ void *myrealloc(void *ptr, size_t new_size);
 void myfree(void *ptr);
 
 
+/* Functions: mycalloc, mymemalign, myusable_size
+ * -----------------------------------------------
+ * Custom versions of calloc, memalign and malloc_usable_size, provided
+ * by the implicit and explicit allocators. mymemalign returns a block
+ * whose payload is aligned to the given power of two, and myusable_size
+ * returns how many bytes of a block can be used, which may be more than
+ * were requested.
+ */
+void *mycalloc(size_t nmemb, size_t size);
+void *mymemalign(size_t alignment, size_t size);
+size_t myusable_size(void *ptr);
+
+
+/* Functions: mymalloc_batch, myfree_batch
+ * -----------------------------------------
+ * Allocate or free many blocks at once, provided by the explicit
+ * allocator. mymalloc_batch stores n blocks of the given size in out and
+ * returns how many it could allocate. myfree_batch frees the n blocks in
+ * ptrs, which it sorts by address along the way.
+ */
+size_t mymalloc_batch(size_t size, size_t n, void **out);
+void myfree_batch(void **ptrs, size_t n);
+
+
+/* Function: myheap_stats
+ * ----------------------
+ * Fills in a snapshot of how the heap is used. The explicit allocator
+ * keeps running totals, so this is cheap enough to poll; the others walk
+ * their heap.
+ */
+void myheap_stats(struct heap_stats *stats);
+
+
+/* Function: mytrim
+ * ----------------
+ * Gives the memory inside large free blocks back to the OS, so the
+ * resident size of the heap drops after a burst of allocations. The
+ * blocks stay free and usable. Returns the number of bytes released.
+ */
+size_t mytrim(void);
+
+
 /* Function: validate_heap
  * -----------------------
  * This is the hook for your heap consistency checker. Returns true
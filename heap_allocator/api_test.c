@@ -0,0 +1,216 @@
+/* File: api_test.c
+ * ----------------
+ * Test driver for the allocator entry points that scripts can't reach
+ * (mycalloc, mymemalign and myusable_size), built against the implicit
+ * and explicit allocators. It runs a few fixed cases, some of which once
+ * broke the heap, then a randomized mix of requests on a set of slots,
+ * tagging every block up to its usable size so that overlapping or
+ * corrupted blocks are caught, and validates the heap after each request.
+ * Returns the number of failed checks.
+ *
+ * Usage: api_test_<allocator> [-n requests] [-s slots]
+ */
+
+#include <error.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "allocator.h"
+#include "test_util.h"
+
+// struct for one live block
+typedef struct {
+    unsigned char *ptr;
+    size_t size;
+} slot_t;
+
+/* Function: fill_slot
+ * -------------------
+ * Writes the slot's tag over its whole block.
+ */
+static void fill_slot(slot_t *slot, int index) {
+    memset(slot->ptr, index & 0xFF, slot->size);
+}
+
+/* Function: slot_intact
+ * ---------------------
+ * Returns whether the first n bytes of the slot's block still hold its tag.
+ */
+static bool slot_intact(const slot_t *slot, int index, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (slot->ptr[i] != (index & 0xFF)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Function: test_memalign_after_split
+ * -----------------------------------
+ * An aligned block taken from a free block that first fit had already
+ * split must not leave two free blocks side by side.
+ */
+static void test_memalign_after_split(void) {
+    reset_heap();
+    void *p = mymalloc(40);
+    void *q = mymemalign(64, 100);
+    check(p != NULL && q != NULL, "memalign after malloc returns blocks");
+    check((uintptr_t)q % 64 == 0, "memalign after malloc is aligned");
+    check(validate_heap(), "heap is valid after memalign splits a block");
+    myfree(q);
+    myfree(p);
+    check(validate_heap(), "heap is valid after freeing an aligned block");
+}
+
+/* Function: is_zeroed
+ * ---------------------
+ * Returns whether the first n bytes at ptr are all zero.
+ */
+static bool is_zeroed(const unsigned char *ptr, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (ptr[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Function: test_calloc
+ * ---------------------
+ * mycalloc must clear memory that earlier blocks dirtied, and must fail
+ * instead of wrapping around when the total size overflows.
+ */
+static void test_calloc(void) {
+    reset_heap();
+    size_t sizes[] = {1, 7, 12, 100, 1000, 5000, 70000, 300000};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        unsigned char *dirty = mymalloc(4 * sizes[i]);
+        check(dirty != NULL, "malloc returns a block to dirty");
+        memset(dirty, 0xAB, 4 * sizes[i]);
+        myfree(dirty);
+        unsigned char *p = mycalloc(4, sizes[i]);
+        check(p != NULL && is_zeroed(p, 4 * sizes[i]), "calloc returns zeroed memory");
+        check(validate_heap(), "heap is valid after calloc");
+        myfree(p);
+    }
+    check(mycalloc(SIZE_MAX / 2, 4) == NULL, "calloc fails when the size overflows");
+    check(validate_heap(), "heap is valid after a failed calloc");
+}
+
+/* Function: test_usable_size
+ * --------------------------
+ * Every byte myusable_size reports must be writable without touching the
+ * next block, for plain and aligned blocks alike.
+ */
+static void test_usable_size(void) {
+    reset_heap();
+    check(myusable_size(NULL) == 0, "usable size of NULL is 0");
+    for (size_t size = 1; size <= 600; size += 7) {
+        slot_t a = {.ptr = size % 2 ? mymalloc(size) : mymemalign(32, size)};
+        slot_t b = {.ptr = mymalloc(size)};
+        if (!check(a.ptr != NULL && b.ptr != NULL, "malloc returns blocks")) {
+            return;
+        }
+        a.size = myusable_size(a.ptr);
+        b.size = myusable_size(b.ptr);
+        check(a.size >= size && b.size >= size, "usable size covers the request");
+        fill_slot(&b, 2);
+        fill_slot(&a, 1);
+        check(slot_intact(&b, 2, b.size), "writing a usable size leaves the next block alone");
+        check(validate_heap(), "heap is valid after writing a whole usable size");
+        myfree(a.ptr);
+        myfree(b.ptr);
+    }
+    check(mymemalign(0, 16) == NULL && mymemalign(48, 16) == NULL,
+          "memalign rejects alignments that aren't powers of two");
+}
+
+/* Function: test_random_mix
+ * -------------------------
+ * Runs num_requests random mallocs, zeroed and aligned mallocs, reallocs
+ * and frees on num_slots slots, checking alignment, zeroing and tags and
+ * validating the heap after every request. New blocks are used up to
+ * their usable size. Stops at the first failure.
+ */
+static void test_random_mix(long num_requests, int num_slots) {
+    reset_heap();
+    slot_t *slots = calloc(num_slots, sizeof(slot_t));
+    if (slots == NULL) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+    uint64_t state = 0x9E3779B97F4A7C15UL;
+
+    for (long req = 0; req < num_requests && nfailures == 0; req++) {
+        uint64_t r = next_random(&state);
+        int i = r % num_slots;
+        r >>= 16;
+        slot_t *slot = &slots[i];
+        size_t size = 1 + (r >> 8) % (r % 8 == 0 ? 8192 : 256);
+
+        if (slot->ptr != NULL && !check(slot_intact(slot, i, slot->size), "block keeps its contents")) {
+            break;
+        }
+        if (slot->ptr == NULL && r % 3 == 0) {
+            size_t alignment = (size_t)16 << (r >> 4) % 9;
+            slot->ptr = mymemalign(alignment, size);
+            check(slot->ptr != NULL && (uintptr_t)slot->ptr % alignment == 0,
+                  "memalign returns an aligned block");
+        } else if (slot->ptr == NULL && r % 3 == 1) {
+            slot->ptr = mycalloc(1 + r % 5, size);
+            size *= 1 + r % 5;
+            check(slot->ptr != NULL && is_zeroed(slot->ptr, size), "calloc returns zeroed memory");
+        } else if (slot->ptr == NULL) {
+            slot->ptr = mymalloc(size);
+            check(slot->ptr != NULL, "malloc returns a block");
+        } else if (r % 3 == 0) {
+            myfree(slot->ptr);
+            slot->ptr = NULL;
+        } else {
+            unsigned char *p = myrealloc(slot->ptr, size);
+            slot->size = size < slot->size ? size : slot->size;
+            if (check(p != NULL, "realloc returns a block")) {
+                slot->ptr = p;
+                check(slot_intact(slot, i, slot->size), "realloc keeps the contents");
+            }
+        }
+        if (slot->ptr != NULL) {
+            slot->size = myusable_size(slot->ptr);
+            check(slot->size >= size, "usable size covers the request");
+            fill_slot(slot, i);
+        }
+        check(validate_heap(), "heap is valid after a random request");
+    }
+    for (int i = 0; i < num_slots; i++) {
+        myfree(slots[i].ptr);
+    }
+    check(validate_heap(), "heap is valid after freeing everything");
+    free(slots);
+}
+
+int main(int argc, char *argv[]) {
+    long num_requests = 20000;
+    int num_slots = 256;
+    int c;
+    while ((c = getopt(argc, argv, "n:s:")) != -1) {
+        if (c == 'n') {
+            num_requests = atol(optarg);
+        } else if (c == 's') {
+            num_slots = atoi(optarg);
+        } else {
+            error(1, 0, "Usage: %s [-n requests] [-s slots]", argv[0]);
+        }
+    }
+    if (num_slots < 1) {
+        error(1, 0, "Need at least one slot.");
+    }
+
+    test_memalign_after_split();
+    test_calloc();
+    test_usable_size();
+    test_random_mix(num_requests, num_slots);
+    printf("%s: %d failed checks\n", argv[0], nfailures);
+    return nfailures;
+}
@@ -0,0 +1,75 @@
+/* File: arena.h
+ * -------------
+ * Interface to the region allocator in bump.c, for work whose blocks all
+ * die together, such as everything allocated while serving one request.
+ * An arena hands out memory by bumping a pointer through a chunk of the
+ * heap segment and chains on another chunk when that one is full. Blocks
+ * are never freed one at a time: arena_release frees everything
+ * allocated since a mark, and arena_reset everything at all, in constant
+ * time. Chunks given back this way are kept for the next arena that
+ * needs one.
+ *
+ * Arenas take their chunks from the heap that bump.c's myinit set up, so
+ * they are only available with the bump allocator, and myinit drops
+ * every arena. None of the functions lock.
+ */
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+#include <stddef.h>  // for size_t
+
+typedef struct arena arena_t;
+
+// a point in an arena to go back to, from arena_mark
+typedef struct {
+    void *chunk;
+    void *top;
+} arena_mark_t;
+
+/* Function: arena_create
+ * ----------------------
+ * Returns a new empty arena, or NULL if the heap can't hold its first
+ * chunk.
+ */
+arena_t *arena_create(void);
+
+/* Function: arena_alloc
+ * ---------------------
+ * Returns size bytes aligned to ALIGNMENT from the arena, or NULL if size
+ * is 0, too big or the heap is full.
+ */
+void *arena_alloc(arena_t *arena, size_t size);
+
+/* Function: arena_realloc
+ * -----------------------
+ * Resizes the block at ptr, which holds old_size bytes, to new_size
+ * bytes. The most recent block of the arena grows or shrinks in place
+ * while its chunk has room; any other block keeps its place when it
+ * shrinks and is copied to a new block when it grows. Returns NULL,
+ * leaving the block as it was, if there is no room.
+ */
+void *arena_realloc(arena_t *arena, void *ptr, size_t old_size, size_t new_size);
+
+/* Functions: arena_mark, arena_release
+ * ------------------------------------
+ * arena_mark returns the arena's current position. arena_release frees
+ * every block allocated since that mark was taken, handing the chunks
+ * that were added since back for reuse. A mark is only good until the
+ * arena is reset or released to an earlier mark.
+ */
+arena_mark_t arena_mark(arena_t *arena);
+void arena_release(arena_t *arena, arena_mark_t mark);
+
+/* Function: arena_reset
+ * ---------------------
+ * Frees every block of the arena, keeping only its first chunk.
+ */
+void arena_reset(arena_t *arena);
+
+/* Function: arena_destroy
+ * -----------------------
+ * Frees the arena itself along with all of its chunks.
+ */
+void arena_destroy(arena_t *arena);
+
+#endif
@@ -0,0 +1,203 @@
+/* File: arena_test.c
+ * ------------------
+ * Test driver for the region allocator in bump.c (see arena.h). It
+ * fills arenas past their first chunk, releases them to marks in older
+ * chunks, resets and destroys them, and checks where later blocks land
+ * to see that chunks are chained and that released ones are reused
+ * instead of growing the heap. Blocks are tagged so that overlapping or
+ * corrupted blocks are caught, and the mymalloc front end is checked at
+ * its size limit. Returns the number of failed checks.
+ *
+ * Usage: arena_test
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "allocator.h"
+#include "arena.h"
+#include "segment.h"
+#include "test_util.h"
+
+// block size for filling arenas, and blocks enough to span several chunks
+#define BLOCK_SIZE 1000
+#define NUM_BLOCKS 300
+
+/* Function: fill_arena
+ * --------------------
+ * Allocates n tagged blocks of BLOCK_SIZE bytes from the arena into
+ * blocks and returns whether all of them could be allocated.
+ */
+static bool fill_arena(arena_t *arena, char **blocks, int n) {
+    for (int i = 0; i < n; i++) {
+        blocks[i] = arena_alloc(arena, BLOCK_SIZE);
+        if (blocks[i] == NULL) {
+            return false;
+        }
+        memset(blocks[i], i & 0xFF, BLOCK_SIZE);
+    }
+    return true;
+}
+
+/* Function: blocks_intact
+ * -----------------------
+ * Returns whether the n blocks from fill_arena still hold their tags.
+ */
+static bool blocks_intact(char **blocks, int n) {
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < BLOCK_SIZE; j++) {
+            if ((unsigned char)blocks[i][j] != (i & 0xFF)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/* Function: test_chaining
+ * -----------------------
+ * An arena that outgrows its first chunk chains on more, and blocks from
+ * different arenas never overlap.
+ */
+static void test_chaining(void) {
+    reset_heap();
+    arena_t *a = arena_create();
+    arena_t *b = arena_create();
+    if (!check(a != NULL && b != NULL, "arena_create returns arenas")) {
+        return;
+    }
+    static char *a_blocks[NUM_BLOCKS], *b_blocks[NUM_BLOCKS];
+    check(fill_arena(a, a_blocks, NUM_BLOCKS / 2) && fill_arena(b, b_blocks, NUM_BLOCKS / 2)
+          && fill_arena(a, a_blocks + NUM_BLOCKS / 2, NUM_BLOCKS / 2), "arenas fill past a chunk");
+    check(blocks_intact(a_blocks, NUM_BLOCKS / 2) && blocks_intact(a_blocks + NUM_BLOCKS / 2, NUM_BLOCKS / 2)
+          && blocks_intact(b_blocks, NUM_BLOCKS / 2),
+          "blocks of interleaved arenas don't overlap");
+    bool aligned = true;
+    for (int i = 0; i < NUM_BLOCKS; i++) {
+        aligned &= (uintptr_t)a_blocks[i] % ALIGNMENT == 0;
+    }
+    check(aligned, "arena blocks are aligned");
+    check(arena_alloc(a, 0) == NULL && arena_alloc(a, (size_t)MAX_REQUEST_SIZE + 1) == NULL,
+          "arena_alloc rejects sizes of 0 and over the limit");
+    check(validate_heap(), "heap is valid next to other arenas");
+}
+
+/* Function: test_release
+ * ----------------------
+ * Releasing to a mark taken in an older chunk puts the next block right
+ * at the mark, and the chunks chained on after it are reused by the next
+ * arena that needs one instead of growing the heap.
+ */
+static void test_release(void) {
+    reset_heap();
+    arena_t *a = arena_create();
+    static char *blocks[NUM_BLOCKS];
+    if (!check(a != NULL && fill_arena(a, blocks, 10), "arena fills")) {
+        return;
+    }
+    arena_mark_t mark = arena_mark(a);
+    char *at_mark = arena_alloc(a, 8);
+    check(fill_arena(a, blocks + 10, NUM_BLOCKS - 10), "arena fills past its first chunk");
+    int first_chained = 11;
+    while (first_chained < NUM_BLOCKS && blocks[first_chained] == blocks[first_chained - 1] + BLOCK_SIZE) {
+        first_chained++;
+    }
+    if (!check(first_chained < NUM_BLOCKS, "a full chunk chains on another")) {
+        return;
+    }
+    // the chunks chained on after the mark's sit together at the end of the heap
+    char *chained_start = blocks[first_chained];
+    char *chained_end = blocks[NUM_BLOCKS - 1] + BLOCK_SIZE;
+    size_t heap_bytes = heap_segment_size();
+
+    arena_release(a, mark);
+    check(arena_alloc(a, 8) == at_mark, "release goes back to the mark");
+    check(blocks_intact(blocks, 10), "release keeps the blocks before the mark");
+
+    arena_t *b = arena_create();
+    static char *b_blocks[NUM_BLOCKS / 2];
+    check(b != NULL && fill_arena(b, b_blocks, NUM_BLOCKS / 2), "a new arena fills");
+    bool reused = (char *)b >= chained_start && (char *)b < chained_end;
+    for (int i = 0; i < NUM_BLOCKS / 2; i++) {
+        reused &= b_blocks[i] >= chained_start && b_blocks[i] + BLOCK_SIZE <= chained_end;
+    }
+    check(reused, "a new arena reuses the released chunks");
+    check(heap_segment_size() == heap_bytes, "reusing spare chunks doesn't grow the heap");
+    check(validate_heap(), "heap is valid after releasing an arena");
+}
+
+/* Function: test_reset_and_destroy
+ * --------------------------------
+ * A reset arena starts over at its first block, and a destroyed arena's
+ * chunks go to the next arena made. Spare chunks can be trimmed.
+ */
+static void test_reset_and_destroy(void) {
+    reset_heap();
+    arena_t *a = arena_create();
+    static char *blocks[NUM_BLOCKS];
+    if (!check(a != NULL && fill_arena(a, blocks, NUM_BLOCKS), "arena fills")) {
+        return;
+    }
+    arena_reset(a);
+    check(arena_alloc(a, BLOCK_SIZE) == blocks[0], "reset starts over at the first block");
+    check(mytrim() > 0, "mytrim releases the chunks a reset gave back");
+
+    arena_destroy(a);
+    arena_t *b = arena_create();
+    check(b == a, "a new arena takes the first chunk of a destroyed one");
+    check(fill_arena(b, blocks, NUM_BLOCKS) && blocks_intact(blocks, NUM_BLOCKS),
+          "trimmed chunks can be used again");
+}
+
+/* Function: test_realloc
+ * ----------------------
+ * The most recent block grows and shrinks in place, an older block keeps
+ * its place when it shrinks, and grows into a copy when it doesn't fit.
+ */
+static void test_realloc(void) {
+    reset_heap();
+    arena_t *a = arena_create();
+    char *old = arena_alloc(a, 100);
+    char *last = arena_alloc(a, 100);
+    if (!check(a != NULL && old != NULL && last != NULL, "arena allocates blocks")) {
+        return;
+    }
+    memset(old, 'o', 100);
+    memset(last, 'l', 100);
+    check(arena_realloc(a, last, 100, 4000) == last, "the last block grows in place");
+    check(arena_realloc(a, last, 4000, 50) == last, "the last block shrinks in place");
+    check(arena_alloc(a, 8) == last + 56, "shrinking the last block gives back its tail");
+    check(arena_realloc(a, old, 100, 40) == old, "an older block shrinks in place");
+    char *moved = arena_realloc(a, old, 40, 200);
+    check(moved != NULL && moved != old && memcmp(moved, old, 40) == 0 && moved[0] == 'o',
+          "an older block grows into a copy");
+    check(arena_realloc(a, NULL, 0, 16) != NULL, "realloc of NULL allocates");
+    check(arena_realloc(a, moved, 200, 0) == NULL, "realloc to 0 bytes fails");
+}
+
+/* Function: test_malloc_limit
+ * ---------------------------
+ * mymalloc and myrealloc take requests of up to MAX_REQUEST_SIZE bytes,
+ * even though each block also holds a size word.
+ */
+static void test_malloc_limit(void) {
+    reset_heap();
+    char *small = mymalloc(100);
+    check(small != NULL, "malloc returns a block");
+    char *big = mymalloc(MAX_REQUEST_SIZE);
+    check(big != NULL, "malloc takes a request of MAX_REQUEST_SIZE");
+    check(mymalloc((size_t)MAX_REQUEST_SIZE + 1) == NULL, "malloc rejects a request over the limit");
+    check(myrealloc(small, MAX_REQUEST_SIZE) != NULL, "realloc takes a size of MAX_REQUEST_SIZE");
+    check(validate_heap(), "heap is valid after requests at the limit");
+}
+
+int main(int argc, char *argv[]) {
+    test_chaining();
+    test_release();
+    test_reset_and_destroy();
+    test_realloc();
+    test_malloc_limit();
+    printf("%s: %d failed checks\n", argv[0], nfailures);
+    return nfailures;
+}
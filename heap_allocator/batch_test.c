@@ -0,0 +1,185 @@
+/* File: batch_test.c
+ * ------------------
+ * Test driver for mymalloc_batch and myfree_batch in the explicit
+ * allocator. Each case allocates blocks in batches, tags them so that
+ * overlapping blocks are caught, frees them in batches that are out of
+ * order or hold repeats and NULLs, and validates the heap after every
+ * batch. myheap_stats tells whether a run of neighbouring blocks was
+ * merged in one step. Returns the number of failed checks.
+ *
+ * Usage: batch_test
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "allocator.h"
+#include "test_util.h"
+
+// blocks in each batch
+#define BATCH_SIZE 200
+
+/* Function: shuffle
+ * -----------------
+ * Puts the pointers in a fixed pseudo-random order.
+ */
+static void shuffle(void **ptrs, size_t n) {
+    uint64_t state = 0x9E3779B97F4A7C15UL;
+    for (size_t i = n; i > 1; i--) {
+        size_t j = next_random(&state) % i;
+        void *tmp = ptrs[i - 1];
+        ptrs[i - 1] = ptrs[j];
+        ptrs[j] = tmp;
+    }
+}
+
+/* Function: tag_blocks
+ * --------------------
+ * Fills each block with the low byte of its index.
+ */
+static void tag_blocks(void **ptrs, size_t n, size_t size) {
+    for (size_t i = 0; i < n; i++) {
+        memset(ptrs[i], i & 0xFF, size);
+    }
+}
+
+/* Function: tags_intact
+ * ---------------------
+ * Returns whether every block still holds the tag tag_blocks wrote.
+ */
+static bool tags_intact(void **ptrs, size_t n, size_t size) {
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = 0; j < size; j++) {
+            if (((unsigned char *)ptrs[i])[j] != (i & 0xFF)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/* Function: live_blocks
+ * ---------------------
+ * Returns how many blocks the allocator counts as in use.
+ */
+static size_t live_blocks(void) {
+    struct heap_stats stats;
+    myheap_stats(&stats);
+    return stats.live_blocks;
+}
+
+/* Function: test_batch_of_size
+ * ----------------------------
+ * Allocates a batch of blocks of the given size, which must all be
+ * aligned and usable without overlap, then frees them in a shuffled
+ * batch with repeats and NULLs mixed in.
+ */
+static void test_batch_of_size(size_t size) {
+    reset_heap();
+    void *ptrs[BATCH_SIZE];
+    size_t n = mymalloc_batch(size, BATCH_SIZE, ptrs);
+    if (!check(n == BATCH_SIZE, "malloc_batch allocates every block")) {
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        check((uintptr_t)ptrs[i] % ALIGNMENT == 0, "batch blocks are aligned");
+        check(myusable_size(ptrs[i]) >= size, "batch blocks hold the size");
+    }
+    tag_blocks(ptrs, n, size);
+    check(tags_intact(ptrs, n, size), "batch blocks don't overlap");
+    check(validate_heap(), "heap is valid after malloc_batch");
+    check(live_blocks() == n, "every batch block counts as live");
+
+    void *frees[BATCH_SIZE + 20];
+    memcpy(frees, ptrs, n * sizeof(void *));
+    for (size_t i = 0; i < 10; i++) {
+        frees[n + 2 * i] = NULL;
+        frees[n + 2 * i + 1] = ptrs[i * 7];
+    }
+    shuffle(frees, n + 20);
+    myfree_batch(frees, n + 20);
+    check(validate_heap(), "heap is valid after free_batch with repeats and NULLs");
+    check(live_blocks() == 0, "free_batch frees every block once");
+}
+
+/* Function: test_adjacent_runs
+ * ----------------------------
+ * Frees every other block of a batch, which can't merge, then the rest,
+ * which joins everything into one free block. Since a run of neighbours
+ * is freed as one block, the second batch may only coalesce with the
+ * free blocks around each run, never between its own blocks.
+ */
+static void test_adjacent_runs(void) {
+    reset_heap();
+    void *ptrs[BATCH_SIZE];
+    size_t n = mymalloc_batch(40, BATCH_SIZE, ptrs);
+    if (!check(n == BATCH_SIZE, "malloc_batch allocates every block")) {
+        return;
+    }
+    void *evens[BATCH_SIZE / 2];
+    void *odds[BATCH_SIZE / 2];
+    for (size_t i = 0; i < n / 2; i++) {
+        evens[i] = ptrs[2 * i];
+        odds[i] = ptrs[2 * i + 1];
+    }
+    shuffle(evens, n / 2);
+    myfree_batch(evens, n / 2);
+    check(validate_heap(), "heap is valid after freeing every other block");
+    check(live_blocks() == n / 2, "free_batch frees exactly the blocks given");
+
+    struct heap_stats before, after;
+    myheap_stats(&before);
+    myfree_batch(odds, n / 2);
+    myheap_stats(&after);
+    check(validate_heap(), "heap is valid after freeing the rest");
+    check(after.live_blocks == 0 && after.free_blocks == 1,
+          "freeing the rest leaves a single free block");
+    check(after.coalesces - before.coalesces <= n, "each odd block merges with its two neighbours at most");
+
+    void *run[BATCH_SIZE];
+    n = mymalloc_batch(24, BATCH_SIZE, run);
+    check(n == BATCH_SIZE && validate_heap(), "a second batch fits in the merged block");
+    shuffle(run, n);
+    myheap_stats(&before);
+    myfree_batch(run, n);
+    myheap_stats(&after);
+    check(validate_heap(), "heap is valid after freeing a whole run");
+    check(after.coalesces - before.coalesces <= 2, "a run of neighbours is freed in one step");
+    check(after.free_blocks == 1, "a freed run merges into one block");
+}
+
+/* Function: test_mixed_sources
+ * ----------------------------
+ * myfree_batch takes blocks from mymalloc as well as from batches, huge
+ * blocks included, interleaved with batch blocks in the heap.
+ */
+static void test_mixed_sources(void) {
+    reset_heap();
+    void *ptrs[2 * BATCH_SIZE + 2];
+    size_t n = 0;
+    for (size_t i = 0; i < 4; i++) {
+        n += mymalloc_batch(100, BATCH_SIZE / 4, ptrs + n);
+        ptrs[n++] = mymalloc(1000 * (i + 1));
+    }
+    n += mymalloc_batch(300 * 1024, 2, ptrs + n);
+    ptrs[n++] = mymalloc(500 * 1024);
+    check(n == BATCH_SIZE + 7, "every block is allocated");
+    check(validate_heap(), "heap is valid with batch, plain and huge blocks");
+    shuffle(ptrs, n);
+    myfree_batch(ptrs, n);
+    check(validate_heap(), "heap is valid after freeing blocks of every kind");
+    check(live_blocks() == 0, "free_batch frees blocks of every kind");
+}
+
+int main(int argc, char *argv[]) {
+    size_t sizes[] = {1, 12, 13, 100, 1000, 5000};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        test_batch_of_size(sizes[i]);
+    }
+    test_adjacent_runs();
+    test_mixed_sources();
+    printf("%s: %d failed checks\n", argv[0], nfailures);
+    return nfailures;
+}
@@ -1,23 +1,60 @@
 /* File: bump.c
  * ------------
- * A "bump" allocator that allocates memory only by tacking on 
- * at the end of the heap.  Free is a no-op: blocks are never coalesced
- * or reused.  Realloc is implemented using malloc/memcpy/free. Operations
- * are fast, but utilization is very poor. It is also missing
- * attention to robustness.
+ * A "bump" allocator that allocates memory only by tacking on
+ * at the end of the heap, organized as arenas (see arena.h). An arena
+ * bumps a pointer through a chunk of the heap and chains on a new chunk,
+ * carved from the end of the heap or taken from the spare chunks that
+ * released arenas gave back, when the current one is full. Releasing
+ * to a mark or resetting an arena splices its newer chunks onto the
+ * spare list in one step, and the pages of spare chunks go back to the
+ * OS in mytrim.
  *
- * This shows the very simplest of approaches; there are better options!
+ * The allocator.h functions run on one arena made by myinit. Each of
+ * their blocks starts with a word holding its payload size, so myrealloc
+ * knows how much to copy. The most recent block can be freed, which
+ * takes it off the arena, and grown or shrunk in place; any other free
+ * is a no-op, so utilization is still poor unless blocks die young.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
 #include "allocator.h"
+#include "arena.h"
+#include "segment.h"
 #include "debug_break.h"
 
+// the heap grows by at least this many bytes at a time
+#define HEAP_EXTEND_MIN (64 * 1024)
+
+// chunks are carved out in multiples of this many bytes
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+#define PAGE_SIZE 4096
+
+struct ArenaChunk {
+    struct ArenaChunk *next;    // newer chunk of the same arena, or next spare
+    size_t size;                // bytes in the chunk, this header included
+};
+
+struct arena {
+    struct ArenaChunk *first;   // oldest chunk, which holds the arena itself
+    struct ArenaChunk *cur;     // newest chunk, where blocks come from
+    char *top;                  // first free byte of cur
+    char *end;                  // end of cur
+    char *last;                 // most recent block, NULL if unknown
+    char *origin;               // top of the arena when it is empty
+};
+
 static void *segment_start;
 static size_t segment_size;
-static size_t nused;
+static char *heap_top;                  // end of the chunks carved so far
+static struct ArenaChunk *spare_chunks;
+static arena_t *heap_arena;             // the arena behind mymalloc
+static size_t nused;                    // payload bytes of live blocks
+static size_t nblocks;
 
 
 /* Function: roundup
@@ -29,66 +66,318 @@ size_t roundup(size_t sz, size_t mult) {
     return (sz + mult - 1) & ~(mult - 1);
 }
 
+/* Function: get_chunk
+ * -------------------
+ * Returns a chunk of at least size bytes, header included: the first
+ * spare chunk that is big enough or else a new one from the end of the
+ * heap, which grows if it must. Returns NULL if the heap is full.
+ */
+struct ArenaChunk *get_chunk(size_t size) {
+    for (struct ArenaChunk **link = &spare_chunks; *link != NULL; link = &(*link)->next) {
+        if ((*link)->size >= size) {
+            struct ArenaChunk *chunk = *link;
+            *link = chunk->next;
+            chunk->next = NULL;
+            return chunk;
+        }
+    }
+
+    size = roundup(size, ARENA_CHUNK_SIZE);
+    char *end = (char *)segment_start + segment_size;
+    if (size > (size_t)(end - heap_top)) {
+        size_t grow = size - (end - heap_top);
+        if (grow < HEAP_EXTEND_MIN) {
+            grow = HEAP_EXTEND_MIN;
+        }
+        if (extend_heap_segment(grow) != end) {
+            return NULL;
+        }
+        segment_size = (char *)heap_segment_start() + heap_segment_size() - (char *)segment_start;
+    }
+    struct ArenaChunk *chunk = (struct ArenaChunk *)heap_top;
+    heap_top += size;
+    chunk->next = NULL;
+    chunk->size = size;
+    return chunk;
+}
+
+/* Function: add_chunk
+ * -------------------
+ * Chains a chunk with room for needed bytes onto the arena and makes it
+ * the one blocks come from. Returns false if the heap is full.
+ */
+bool add_chunk(arena_t *arena, size_t needed) {
+    struct ArenaChunk *chunk = get_chunk(sizeof(struct ArenaChunk) + needed);
+    if (chunk == NULL) {
+        return false;
+    }
+    arena->cur->next = chunk;
+    arena->cur = chunk;
+    arena->top = (char *)(chunk + 1);
+    arena->end = (char *)chunk + chunk->size;
+    return true;
+}
+
+arena_t *arena_create(void) {
+    struct ArenaChunk *chunk = get_chunk(sizeof(struct ArenaChunk) + sizeof(arena_t));
+    if (chunk == NULL) {
+        return NULL;
+    }
+    arena_t *arena = (arena_t *)(chunk + 1);
+    arena->first = chunk;
+    arena->cur = chunk;
+    arena->origin = (char *)(arena + 1);
+    arena->top = arena->origin;
+    arena->end = (char *)chunk + chunk->size;
+    arena->last = NULL;
+    return arena;
+}
+
+/* Function: bump_alloc
+ * --------------------
+ * Does the work of arena_alloc for a size that is not 0, without holding
+ * it to MAX_REQUEST_SIZE, so that mymalloc can put its size word on top
+ * of a request of that size.
+ */
+void *bump_alloc(arena_t *arena, size_t size) {
+    size_t needed = roundup(size, ALIGNMENT);
+    if (needed > (size_t)(arena->end - arena->top) && !add_chunk(arena, needed)) {
+        return NULL;
+    }
+    char *ptr = arena->top;
+    arena->top += needed;
+    arena->last = ptr;
+    return ptr;
+}
+
+/* Function: bump_realloc
+ * ----------------------
+ * Does the work of arena_realloc for a block and a new size that is not
+ * 0, without holding the size to MAX_REQUEST_SIZE, like bump_alloc.
+ */
+void *bump_realloc(arena_t *arena, void *ptr, size_t old_size, size_t new_size) {
+    size_t needed = roundup(new_size, ALIGNMENT);
+    if (ptr == arena->last && needed <= (size_t)(arena->end - (char *)ptr)) {
+        arena->top = (char *)ptr + needed;
+        return ptr;
+    }
+    if (new_size <= old_size) {
+        return ptr;
+    }
+    void *new_ptr = bump_alloc(arena, new_size);
+    if (new_ptr != NULL) {
+        memcpy(new_ptr, ptr, old_size);
+    }
+    return new_ptr;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    if (size == 0 || size > MAX_REQUEST_SIZE) {
+        return NULL;
+    }
+    return bump_alloc(arena, size);
+}
+
+void *arena_realloc(arena_t *arena, void *ptr, size_t old_size, size_t new_size) {
+    if (ptr == NULL) {
+        return arena_alloc(arena, new_size);
+    }
+    if (new_size == 0 || new_size > MAX_REQUEST_SIZE) {
+        return NULL;
+    }
+    return bump_realloc(arena, ptr, old_size, new_size);
+}
+
+arena_mark_t arena_mark(arena_t *arena) {
+    return (arena_mark_t){.chunk = arena->cur, .top = arena->top};
+}
+
+void arena_release(arena_t *arena, arena_mark_t mark) {
+    struct ArenaChunk *chunk = mark.chunk;
+    if (chunk != arena->cur) {
+        arena->cur->next = spare_chunks;
+        spare_chunks = chunk->next;
+        chunk->next = NULL;
+        arena->cur = chunk;
+        arena->end = (char *)chunk + chunk->size;
+    }
+    arena->top = mark.top;
+    arena->last = NULL;
+}
+
+void arena_reset(arena_t *arena) {
+    arena_release(arena, (arena_mark_t){.chunk = arena->first, .top = arena->origin});
+}
+
+void arena_destroy(arena_t *arena) {
+    arena->cur->next = spare_chunks;
+    spare_chunks = arena->first;
+}
+
 /* Function: myinit
  * ----------------
  * This function initializes our global variables based on the specified
- * segment boundary parameters.
+ * segment boundary parameters, which drops every arena, and makes the
+ * arena that mymalloc allocates from.
  */
 bool myinit(void *start, size_t size) {
     segment_start = start;
     segment_size = size;
+    heap_top = start;
+    spare_chunks = NULL;
     nused = 0;
-    return true;
+    nblocks = 0;
+    heap_arena = arena_create();
+    return heap_arena != NULL;
 }
 
 /* Function: mymalloc
  * ------------------
  * This function satisfies an allocation request by placing
- * the allocated block at the end of the heap.  No search means
- * it is fast, but no memory recycling means very poor utilization.
+ * the allocated block at the end of the heap arena, after a word that
+ * holds its size.  No search means it is fast, but no memory recycling
+ * means very poor utilization.
  */
 void *mymalloc(size_t requestedsz) {
-    size_t needed = roundup(requestedsz, ALIGNMENT);
-    if (needed + nused > segment_size) {
+    if (requestedsz == 0 || requestedsz > MAX_REQUEST_SIZE) {
         return NULL;
     }
-    void *ptr = (char *)segment_start + nused;
-    nused += needed;
-    return ptr;
+    size_t *hd = bump_alloc(heap_arena, ALIGNMENT + requestedsz);
+    if (hd == NULL) {
+        return NULL;
+    }
+    *hd = roundup(requestedsz, ALIGNMENT);
+    nused += *hd;
+    nblocks++;
+    return hd + 1;
 }
 
 /* Function: myfree
  * ----------------
- * This function does nothing - fast!... but lame :(
+ * This function takes the block off the end of the heap arena if it is
+ * the most recent one, and otherwise does nothing - fast!... but lame :(
  */
-void myfree(void *ptr) {}
+void myfree(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    size_t *hd = (size_t *)ptr - 1;
+    nused -= *hd;
+    nblocks--;
+    if ((char *)hd == heap_arena->last) {
+        heap_arena->top = heap_arena->last;
+        heap_arena->last = NULL;
+    }
+}
 
 /* Function: realloc
  * -----------------
- * This function satisfies requests for resizing previously-allocated memory
- * blocks by allocating a new block of the requested size and moving the
- * existing contents to that region.  It's not particularly efficient.
+ * This function resizes the most recent block in place when its chunk
+ * has room, keeps any other block where it is when it shrinks, and
+ * otherwise moves the block's payload to a new block at the end.
  */
 void *myrealloc(void *oldptr, size_t newsz) {
-    void *newptr = mymalloc(newsz);
-    memcpy(newptr, oldptr, newsz);
-    myfree(oldptr);
-    return newptr;
+    if (oldptr == NULL) {
+        return mymalloc(newsz);
+    }
+    if (newsz == 0) {
+        myfree(oldptr);
+        return NULL;
+    }
+    if (newsz > MAX_REQUEST_SIZE) {
+        return NULL;
+    }
+    size_t *hd = (size_t *)oldptr - 1;
+    size_t oldsz = *hd;
+    bool was_last = (char *)hd == heap_arena->last;
+    size_t *new_hd = bump_realloc(heap_arena, hd, ALIGNMENT + oldsz, ALIGNMENT + newsz);
+    if (new_hd == NULL) {
+        return NULL;
+    }
+    //a block that shrank in the middle of the arena keeps its size
+    if (new_hd != hd || was_last) {
+        *new_hd = roundup(newsz, ALIGNMENT);
+    }
+    nused += *new_hd - oldsz;
+    return new_hd + 1;
+}
+
+/* Function: mytrim
+ * ----------------
+ * This function gives the pages of the spare chunks back to the OS and
+ * returns how many bytes that released. Blocks in use are never moved,
+ * so there is nothing else to give back.
+ */
+size_t mytrim() {
+    size_t released = 0;
+    for (struct ArenaChunk *chunk = spare_chunks; chunk != NULL; chunk = chunk->next) {
+        uintptr_t start = roundup((uintptr_t)(chunk + 1), PAGE_SIZE);
+        uintptr_t end = ((uintptr_t)chunk + chunk->size) & ~(uintptr_t)(PAGE_SIZE - 1);
+        if (end > start && madvise((void *)start, end - start, MADV_DONTNEED) == 0) {
+            released += end - start;
+        }
+    }
+    return released;
+}
+
+/* Function: myheap_stats
+ * ----------------------
+ * The memory of a freed block is never handed out again unless it was
+ * the most recent one, so nothing counts as free and the snapshot is
+ * just the end of the heap and the blocks not yet freed.
+ */
+void myheap_stats(struct heap_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->heap_bytes = segment_size;
+    stats->live_bytes = nused;
+    stats->live_blocks = nblocks;
+}
+
+/* Function: in_chunks
+ * -------------------
+ * This function returns whether the given chunk header lies within the
+ * part of the heap carved into chunks.
+ */
+bool in_chunks(struct ArenaChunk *chunk) {
+    return (char *)chunk >= (char *)segment_start
+        && (char *)(chunk + 1) <= heap_top
+        && chunk->size <= (size_t)(heap_top - (char *)chunk);
 }
 
 /* Function: validate_heap
  * -----------------------
  * This function checks for potential errors/inconsistencies in the heap data
  * structures and returns false if there were issues, or true otherwise.
- * This implementation checks if the allocator has used more space than is
- * available.
+ * This implementation checks that the chunks fit in the heap, that the
+ * heap arena's chunks are chained up to its current one and that its top
+ * lies within that chunk.
  */
 bool validate_heap() {
-    if (nused > segment_size) {
+    if (heap_top > (char *)segment_start + segment_size) {
         printf("Oops! Have used more heap than total available?!\n");
         breakpoint();   // call this function to stop in gdb to poke around
         return false;
     }
+    struct ArenaChunk *chunk = heap_arena->first;
+    while (chunk != heap_arena->cur) {
+        if (chunk == NULL || !in_chunks(chunk)) {
+            printf("The heap arena's chain of chunks is broken at %p.\n", chunk);
+            breakpoint();
+            return false;
+        }
+        chunk = chunk->next;
+    }
+    if (!in_chunks(chunk) || chunk->next != NULL) {
+        printf("The heap arena's current chunk at %p is not at the end of its chain.\n", chunk);
+        breakpoint();
+        return false;
+    }
+    if (heap_arena->end != (char *)chunk + chunk->size
+        || heap_arena->top < (char *)(chunk + 1) || heap_arena->top > heap_arena->end) {
+        printf("The top of the heap arena, %p, is outside its current chunk.\n", heap_arena->top);
+        breakpoint();
+        return false;
+    }
     return true;
 }
 
@@ -96,21 +385,22 @@ bool validate_heap() {
  * -------------------
  * This function is not called from anywhere, it is just here to
  * demonstrate how such a function might be a useful debugging aid.
- * You can then call the function from gdb to view the contents of the heap segment. 
- * For the bump allocator, the heap contains no block headers or 
- * heap housekeeping to provide structure, so all that can be displayed 
- * is a dump of the raw bytes. For a more structured allocator, you 
- * could implement dump_heap to instead just print the block headers, 
- * which would be less overwhelming to wade through for debugging.
+ * You can then call the function from gdb to view the contents of the heap segment.
+ * For the bump allocator, it prints the chunks of the heap arena, with
+ * how much of the current one is used, and the spare chunks.
  */
 void dump_heap() {
-    printf("Heap segment starts at address %p, ends at %p. %lu bytes currently used.", 
-        segment_start, (char *)segment_start + segment_size, nused);
-    for (int i = 0; i < nused; i++) {
-        unsigned char *cur = (unsigned char *)segment_start + i;
-        if (i % 32 == 0) {
-            printf("\n%p: ", cur);
+    printf("Heap segment starts at address %p, ends at %p. %lu bytes carved into chunks.",
+        segment_start, (char *)segment_start + segment_size, (unsigned long)(heap_top - (char *)segment_start));
+    for (struct ArenaChunk *chunk = heap_arena->first; chunk != NULL; chunk = chunk->next) {
+        printf("\n%p: %lu bytes", chunk, (unsigned long)chunk->size);
+        if (chunk == heap_arena->cur) {
+            printf(", %lu used", (unsigned long)(heap_arena->top - (char *)chunk));
         }
-        printf("%02x ", *cur);
     }
+    printf("\nSpare chunks:");
+    for (struct ArenaChunk *chunk = spare_chunks; chunk != NULL; chunk = chunk->next) {
+        printf("\n%p: %lu bytes", chunk, (unsigned long)chunk->size);
+    }
+    printf("\n");
 }
@@ -0,0 +1,32 @@
+/* File: engine.h
+ * --------------
+ * Interface to the explicit allocator when it is compiled as the back
+ * end of a front-end allocator such as threaded.c. The Makefile builds
+ * explicit.c a second time with its allocator.h entry points renamed to
+ * the engine_ names below (see ENGINE_NAMES), so a front end can define
+ * mymalloc and friends itself and hand requests on to the engine.
+ */
+#ifndef _ENGINE_H
+#define _ENGINE_H
+
+#include <stdbool.h> // for bool
+#include <stddef.h>  // for size_t
+#include "allocator.h" // for struct heap_stats
+
+bool engine_init(void *segment_start, size_t segment_size);
+void *engine_malloc(size_t size);
+void *engine_realloc(void *ptr, size_t new_size);
+void engine_free(void *ptr);
+size_t engine_trim(void);
+void engine_heap_stats(struct heap_stats *stats);
+bool engine_validate_heap(void);
+
+/* Functions: hdptr_of, get_pl_size
+ * --------------------------------
+ * Block layout helpers of explicit.c, used to read the payload size of
+ * a block handed out by the engine.
+ */
+void *hdptr_of(void *plptr);
+size_t get_pl_size(void *hdptr);
+
+#endif
@@ -2,25 +2,207 @@
  * Author: Tiantian Fang
  *
  * This file contains my implementation of the explicit allocator.
+ * Each block has a 4-byte header holding the block size, which counts
+ * the header and is a multiple of ALIGNMENT, with bit 0 set if the block
+ * is allocated and bit 1 set if the block right before it in the heap is
+ * free. Headers sit 4 bytes before an aligned address, so every payload
+ * is 4 bytes short of a multiple of ALIGNMENT and the smallest block takes
+ * 16 bytes. A free block stores its list links at the start of its
+ * payload, as 32-bit offsets from the start of the heap segment, and a
+ * copy of its header (a footer) in its last 4 bytes, so myfree can find
+ * its left neighbour and coalesce both ways. The 32-bit sizes and offsets
+ * limit the heap to MAX_HEAP_SIZE bytes.
+ *
+ * Free blocks smaller than TREE_MIN_SIZE are kept in a LIFO list searched
+ * with first fit, or with next fit, best fit or good fit when built with
+ * -DFIT_POLICY=NEXT_FIT, BEST_FIT or GOOD_FIT. Larger free blocks are
+ * indexed by size in a treap whose nodes also live in the free payloads;
+ * it is keyed by (size, address) and each node's priority is a hash of
+ * its address, so no extra space is needed and large requests get a best
+ * fit in O(log n).
+ *
+ * Built with -DLIST_ORDER=ADDRESS_ORDER, the list is kept sorted by
+ * address instead, so first fit packs small blocks toward the start of
+ * the heap and a block's free neighbours sit next to it in the list. To
+ * keep inserts at O(log n), the list is the bottom level of a skip list
+ * whose upper links follow the list links in the free payload. A block's
+ * height comes from a hash of its address, like a tree node's priority,
+ * capped by how many links its payload has room for, so it needs no
+ * space of its own either.
+ *
+ * Built with -DQUICK_MAX_SIZE=N, freed blocks with payloads of at most N
+ * bytes are not coalesced right away but pushed on a LIFO quick list for
+ * their exact size, keeping their alloc bit, so the next request of that
+ * size pops one without a search or a split. The quick lists are swept,
+ * freeing and coalescing their blocks for real, once they hold
+ * QUICK_MAX_BYTES bytes, in mytrim and whenever a search finds nothing
+ * but the last block of the heap, or nothing at all, so the heap doesn't
+ * grow past blocks that would have merged. A single list is swept once
+ * QUICK_IDLE_FREES blocks were pushed on it without one being reused, and
+ * when myrealloc could grow into one of its blocks. The parked blocks
+ * still cost more utilization than the saved splits are worth on the
+ * sample scripts, so quick lists are off by default.
+ *
+ * The heap starts out as whatever part of the segment is committed when
+ * myinit is called, possibly nothing, and grows at its end through
+ * extend_heap_segment whenever no free block fits a request.
+ *
+ * The pages inside free blocks of at least TRIM_MIN_SIZE bytes are given
+ * back to the OS with madvise. mytrim does this for all of them; myfree
+ * does it on its own once TRIM_HYSTERESIS bytes of such blocks have been
+ * freed, but then only for blocks that were already free at the previous
+ * pass, so a large block that is freed and reused over and over keeps
+ * its pages.
+ *
+ * Requests of at least MMAP_THRESHOLD bytes don't use the heap at all:
+ * each gets a mapping of its own from map_huge_segment, with a header
+ * like any other block but bit 2 set. Such a block is resized with
+ * mremap, so it can grow without being copied, and is unmapped as soon
+ * as it is freed.
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <sys/mman.h>
 #include "allocator.h"
+#include "segment.h"
 #include "debug_break.h"
 
+#define ALLOC_BIT 1
+#define PREV_FREE_BIT 2
+#define MMAPPED_BIT 4
+#define FLAG_BITS (ALLOC_BIT | PREV_FREE_BIT | MMAPPED_BIT)
+
+typedef uint32_t header_t;
+#define HEADER_SIZE sizeof(header_t)
+
+// largest heap segment whose block sizes and offsets fit in 32 bits
+#define MAX_HEAP_SIZE ((size_t)1 << 32)
+
+// requests of at least this many bytes get a mapping of their own
+#ifndef MMAP_THRESHOLD
+#define MMAP_THRESHOLD (256 * 1024)
+#endif
+
+// the heap grows by at least this many bytes at a time
+#define HEAP_EXTEND_MIN (64 * 1024)
+
+#define PAGE_SIZE 4096
+// free blocks with at least this payload size get their pages released
+#define TRIM_MIN_SIZE (64 * 1024)
+// bytes of such blocks freed between two automatic trim passes
+#define TRIM_HYSTERESIS (1024 * 1024)
+// trim epoch of a block whose pages were already released
+#define TRIMMED_EPOCH SIZE_MAX
+
+// placement policies for small requests, one of which is picked with
+// -DFIT_POLICY; large requests always take the best fit from the tree
+#define FIRST_FIT 0
+#define NEXT_FIT 1      // first fit, starting where the last search ended
+#define BEST_FIT 2
+#define GOOD_FIT 3      // best of the first GOOD_FIT_CANDIDATES blocks that fit
+#ifndef FIT_POLICY
+#define FIT_POLICY FIRST_FIT
+#endif
+#ifndef GOOD_FIT_CANDIDATES
+#define GOOD_FIT_CANDIDATES 8
+#endif
+
+// orders of the list of small free blocks, one of which is picked with
+// -DLIST_ORDER
+#define LIFO_ORDER 0
+#define ADDRESS_ORDER 1     // sorted by address, indexed with a skip list
+#ifndef LIST_ORDER
+#define LIST_ORDER LIFO_ORDER
+#endif
+
+// validate_heap marks free blocks it has seen with this footer bit
+#define FOOTER_MARK 1
+
+// with -DVALIDATE_INTERVAL=N, every Nth request validates the heap
+#ifndef VALIDATE_INTERVAL
+#define VALIDATE_INTERVAL 0
+#endif
+
+static char *heap_base;    // start of the heap segment, where offsets start
 static void *first_hd;
 static size_t total_size;
+// prev-free bit of the end of the heap, as if it were a block header
+static bool end_prev_free;
 
+// links are offsets from heap_base, 0 for none
 struct ListedBl
 {
-    struct ListedBl *prev;
-    struct ListedBl *next;
+    uint32_t prev;
+    uint32_t next;
+    uint32_t skip[];    // links of the upper skip list levels, in address order only
 };
 
+struct TreeBl
+{
+    struct TreeBl *left;
+    struct TreeBl *right;
+    size_t trim_epoch;    // trim pass during which the block was freed
+};
+
+// a free block holds its list links plus a footer
+#define MIN_PL_SIZE (sizeof(struct ListedBl) + HEADER_SIZE)
+
+// a leftover tail is only split off if it makes a block of at least this
+// many bytes, since smaller free blocks rarely fit and slow the list down
+#define MIN_SPLIT_SIZE 32
+
+// free blocks with at least this payload size go in the tree
+#define TREE_MIN_SIZE 1024
+
+// freed blocks with at most this payload size go on a quick list, 0 for
+// none; the lists are swept once they hold QUICK_MAX_BYTES bytes
+#ifndef QUICK_MAX_SIZE
+#define QUICK_MAX_SIZE 0
+#endif
+#ifndef QUICK_MAX_BYTES
+#define QUICK_MAX_BYTES 4096
+#endif
+// a quick list is swept on its own once this many blocks have been pushed
+// on it since it last served a request
+#ifndef QUICK_IDLE_FREES
+#define QUICK_IDLE_FREES 8
+#endif
+#define QUICK_CLASSES ((QUICK_MAX_SIZE + HEADER_SIZE) / ALIGNMENT + 1)
+
 static struct ListedBl *first_listed_bl;
+// in address order, skip list levels above the list itself; a listed block
+// is on levels 1 to skip_height - 1 of them
+#define SKIP_LEVELS 16
+static uint32_t skip_heads[SKIP_LEVELS - 1];
+static struct TreeBl *tree_root;
+// where the next next-fit search starts, NULL for the front of the list
+static struct ListedBl *rover;
+// quick lists by block size / ALIGNMENT, linked through the next field
+static struct ListedBl *quick_lists[QUICK_CLASSES];
+static size_t quick_idle[QUICK_CLASSES];   // pushes since the last pop
+static size_t nquick_bl;
+static size_t quick_pl_bytes;
+
+static size_t trim_epoch;
+static size_t freed_since_trim;
+
+static size_t ops_since_validate;
+
+// running totals for myheap_stats
+static size_t nfree_bl;
+static size_t free_pl_bytes;
+static size_t free_hist[HEAP_STATS_BUCKETS];
+static size_t small_counts[TREE_MIN_SIZE / ALIGNMENT];  // listed blocks by size
+static size_t nused_bl;         // blocks in use in the heap
+static size_t nhuge_bl;
+static size_t huge_pl_bytes;
+static size_t nsplits;
+static size_t ncoalesces;
+static size_t nquick_allocs;
+static size_t nquick_frees;
 
 /* Function: roundup_bl (from bump.c)
  *
@@ -31,15 +213,15 @@ static struct ListedBl *first_listed_bl;
  * Returns: 
  * the rounded size
  *
- * This function rounds up the block size to the given multiple.
- * If the size is smaller than the minimum block size requirement,
- * roundup to the minimum size.
+ * This function rounds up a payload size so that the whole block, header
+ * included, is a multiple of mult. If the size is smaller than the
+ * minimum block size requirement, roundup to the minimum size.
  */
 size_t roundup_bl(size_t sz, size_t mult) {
-    if (sz <= sizeof(struct ListedBl)) {
-        return sizeof(struct ListedBl);
+    if (sz <= MIN_PL_SIZE) {
+        return MIN_PL_SIZE;
     }
-    return (sz + mult - 1) & ~(mult - 1);
+    return ((sz + HEADER_SIZE + mult - 1) & ~(mult - 1)) - HEADER_SIZE;
 }
 
 /* Function: hdptr_of
@@ -53,7 +235,7 @@ size_t roundup_bl(size_t sz, size_t mult) {
  * This function returns a pointer to the header of given payload.
  */
 void *hdptr_of(void *plptr) {
-    return (char *)plptr - ALIGNMENT;
+    return (char *)plptr - HEADER_SIZE;
 }
 
 /* Function: plptr_of
@@ -67,7 +249,7 @@ void *hdptr_of(void *plptr) {
  * This function returns a pointer to the payload of given header.
  */
 void *plptr_of(void *hdptr) {
-    return (char *)hdptr + ALIGNMENT;
+    return (char *)hdptr + HEADER_SIZE;
 }
 /* Function: isfree
  *
@@ -80,7 +262,51 @@ void *plptr_of(void *hdptr) {
  * This function returns whether the given block is free.
  */
 bool isfree(void *hdptr){
-    return ((*(size_t *)hdptr) & 1) == 0;
+    return ((*(header_t *)hdptr) & ALLOC_BIT) == 0;
+}
+
+/* Function: isprevfree
+ *
+ * Parameters:
+ * hdptr - pointer to the header of a block
+ *
+ * Returns: 
+ * whether the block right before it in the heap is free
+ *
+ * This function returns whether the left neighbour of the given block is free.
+ */
+bool isprevfree(void *hdptr) {
+    return ((*(header_t *)hdptr) & PREV_FREE_BIT) != 0;
+}
+
+/* Function: ismapped
+ *
+ * Parameters:
+ * hdptr - pointer to the header of a block
+ *
+ * Returns: 
+ * whether the block has a mapping of its own
+ *
+ * This function returns whether the given block is a huge block that
+ * lives outside the heap.
+ */
+bool ismapped(void *hdptr) {
+    return ((*(header_t *)hdptr) & MMAPPED_BIT) != 0;
+}
+
+/* Function: in_heap
+ *
+ * Parameters:
+ * hdptr - pointer to a header
+ *
+ * Returns: 
+ * whether the header lies before the end of the heap
+ *
+ * This function returns whether the given header belongs to a block
+ * or is the end of the heap.
+ */
+bool in_heap(void *hdptr) {
+    return (char *)hdptr < (char *)first_hd + total_size;
 }
 
 /* Function: get_pl_size
@@ -94,12 +320,7 @@ bool isfree(void *hdptr){
  * This function returns the block's payload size.
  */
 size_t get_pl_size(void *hdptr) {
-    if (isfree(hdptr)) {
-        return *(size_t *)hdptr;
-    }
-    else {       
-        return *(size_t *)hdptr - 1;
-    }
+    return (*(header_t *)hdptr & ~(header_t)FLAG_BITS) - HEADER_SIZE;
 }
 
 /* Function: get_next_hdptr
@@ -113,7 +334,349 @@ size_t get_pl_size(void *hdptr) {
  * This function returns a pointer to the next header in the heap.
  */
 void *get_next_hdptr(void *cur_hdptr) {
-    return (char *)cur_hdptr + ALIGNMENT + get_pl_size(cur_hdptr);
+    return (char *)cur_hdptr + HEADER_SIZE + get_pl_size(cur_hdptr);
+}
+
+/* Function: get_prev_hdptr
+ *
+ * Parameters:
+ * cur_hdptr - pointer to the current header, whose left neighbour is free
+ *
+ * Returns: 
+ * pointer to the previous header
+ *
+ * This function reads the footer of the free block to the left of
+ * the given block and returns a pointer to that block's header.
+ */
+void *get_prev_hdptr(void *cur_hdptr) {
+    header_t prev_bl_size = *((header_t *)cur_hdptr - 1);
+    return (char *)cur_hdptr - prev_bl_size;
+}
+
+/* Function: set_prev_free
+ *
+ * Parameters:
+ * hdptr - pointer to the header of a block, or to the end of the heap
+ * prev_free - whether the left neighbour of the block is free
+ *
+ * This function updates the prev-free bit of a block.
+ */
+void set_prev_free(void *hdptr, bool prev_free) {
+    if (!in_heap(hdptr)) {
+        end_prev_free = prev_free;
+        return;
+    }
+    if (prev_free) {
+        *(header_t *)hdptr |= PREV_FREE_BIT;
+    }
+    else {
+        *(header_t *)hdptr &= ~(header_t)PREV_FREE_BIT;
+    }
+}
+
+/* Function: listed_bl_at
+ *
+ * Parameters:
+ * offset - offset of a listed block from heap_base, or 0
+ *
+ * Returns: 
+ * pointer to the listed block, or NULL for an offset of 0
+ *
+ * This function follows a link of the free list.
+ */
+struct ListedBl *listed_bl_at(uint32_t offset) {
+    return offset != 0 ? (struct ListedBl *)(heap_base + offset) : NULL;
+}
+
+/* Function: offset_of
+ *
+ * Parameters:
+ * bl - a listed block, or NULL
+ *
+ * Returns: 
+ * the block's offset from heap_base, or 0 for NULL
+ *
+ * This function turns a listed block into a link of the free list.
+ */
+uint32_t offset_of(struct ListedBl *bl) {
+    return bl != NULL ? (char *)bl - heap_base : 0;
+}
+
+/* Function: tree_priority
+ *
+ * Parameters:
+ * node - a tree node
+ *
+ * Returns: 
+ * the node's heap priority
+ *
+ * This function hashes the node's address into its treap priority.
+ */
+size_t tree_priority(struct TreeBl *node) {
+    return (uintptr_t)node * 0x9E3779B97F4A7C15UL;
+}
+
+/* Function: tree_less
+ *
+ * Parameters:
+ * a_size, a - payload size and node of the first block
+ * b - node of the second block
+ *
+ * Returns: 
+ * whether the first block orders before the second
+ *
+ * This function compares two tree blocks by size, then by address.
+ */
+bool tree_less(size_t a_size, struct TreeBl *a, struct TreeBl *b) {
+    size_t b_size = get_pl_size(hdptr_of(b));
+    return a_size < b_size || (a_size == b_size && a < b);
+}
+
+/* Function: insert_tree_bl
+ *
+ * Parameters:
+ * node - payload of a free block
+ * pl_size - its payload size
+ *
+ * This function inserts a free block into the tree. It walks down until
+ * the node's priority beats the subtree's root, then splits that subtree
+ * around the node's key into its left and right children.
+ */
+void insert_tree_bl(struct TreeBl *node, size_t pl_size) {
+    struct TreeBl **link = &tree_root;
+    size_t priority = tree_priority(node);
+    while (*link != NULL && tree_priority(*link) > priority) {
+        link = tree_less(pl_size, node, *link) ? &(*link)->left : &(*link)->right;
+    }
+
+    struct TreeBl *cur = *link;
+    struct TreeBl **left = &node->left;
+    struct TreeBl **right = &node->right;
+    while (cur != NULL) {
+        if (tree_less(pl_size, node, cur)) {
+            *right = cur;
+            right = &cur->left;
+            cur = cur->left;
+        }
+        else {
+            *left = cur;
+            left = &cur->right;
+            cur = cur->right;
+        }
+    }
+    *left = NULL;
+    *right = NULL;
+    *link = node;
+}
+
+/* Function: remove_tree_bl
+ *
+ * Parameters:
+ * node - payload of a free block in the tree
+ * pl_size - its payload size
+ *
+ * This function finds the link to the node, rotates the node down until
+ * it has at most one child and then splices it out.
+ */
+void remove_tree_bl(struct TreeBl *node, size_t pl_size) {
+    struct TreeBl **link = &tree_root;
+    while (*link != node) {
+        link = tree_less(pl_size, node, *link) ? &(*link)->left : &(*link)->right;
+    }
+
+    while (node->left != NULL && node->right != NULL) {
+        struct TreeBl *child;
+        if (tree_priority(node->left) > tree_priority(node->right)) {
+            child = node->left;
+            node->left = child->right;
+            child->right = node;
+            *link = child;
+            link = &child->right;
+        }
+        else {
+            child = node->right;
+            node->right = child->left;
+            child->left = node;
+            *link = child;
+            link = &child->left;
+        }
+    }
+    *link = node->left != NULL ? node->left : node->right;
+}
+
+/* Function: bestfit_tree_bl
+ *
+ * Parameters:
+ * needed_size - needed size to be allocated
+ *
+ * Returns: 
+ * the smallest tree block with at least needed_size bytes, or NULL
+ *
+ * This function searches the tree for the best-fitting large block.
+ */
+struct TreeBl *bestfit_tree_bl(size_t needed_size) {
+    struct TreeBl *cur = tree_root;
+    struct TreeBl *best = NULL;
+    while (cur != NULL) {
+        if (get_pl_size(hdptr_of(cur)) >= needed_size) {
+            best = cur;
+            cur = cur->left;
+        }
+        else {
+            cur = cur->right;
+        }
+    }
+    return best;
+}
+
+/* Function: stats_bucket
+ *
+ * Parameters:
+ * pl_size - payload size of a free block
+ *
+ * Returns: 
+ * the block's bucket in the free block histogram
+ */
+int stats_bucket(size_t pl_size) {
+    int bucket = 63 - __builtin_clzl(pl_size);
+    return bucket < HEAP_STATS_BUCKETS ? bucket : HEAP_STATS_BUCKETS - 1;
+}
+
+/* Function: count_free_bl
+ *
+ * Parameters:
+ * pl_size - payload size of a free block
+ * added - whether the block was added or removed
+ *
+ * This function keeps the totals of free blocks up to date as blocks are
+ * added to and removed from the list and the tree.
+ */
+void count_free_bl(size_t pl_size, bool added) {
+    if (added) {
+        nfree_bl++;
+        free_pl_bytes += pl_size;
+        free_hist[stats_bucket(pl_size)]++;
+        if (pl_size < TREE_MIN_SIZE) {
+            small_counts[pl_size / ALIGNMENT]++;
+        }
+    }
+    else {
+        nfree_bl--;
+        free_pl_bytes -= pl_size;
+        free_hist[stats_bucket(pl_size)]--;
+        if (pl_size < TREE_MIN_SIZE) {
+            small_counts[pl_size / ALIGNMENT]--;
+        }
+    }
+}
+
+/* Function: skip_height
+ *
+ * Parameters:
+ * bl - a listed block
+ * pl_size - its payload size
+ *
+ * Returns:
+ * number of skip list levels the block is on, counting the list itself
+ *
+ * This function hashes the block's address into a height that is 1 with
+ * probability 3/4, 2 with probability 3/16 and so on. The height is capped
+ * by the links that fit between the list links and the footer, so it
+ * stays the same for as long as the block is listed.
+ */
+size_t skip_height(struct ListedBl *bl, size_t pl_size) {
+    uint32_t hash = ((uintptr_t)bl * 0x9E3779B97F4A7C15UL) >> 32;
+    size_t height = 1 + __builtin_ctz(hash | (uint32_t)1 << (2 * (SKIP_LEVELS - 1))) / 2;
+    size_t room = 1 + (pl_size - MIN_PL_SIZE) / sizeof(uint32_t);
+    return height < room ? height : room;
+}
+
+/* Function: skip_link
+ *
+ * Parameters:
+ * bl - a listed block, or NULL for the heads
+ * level - skip list level above the list, from 1
+ *
+ * Returns:
+ * pointer to the block's link on that level
+ */
+uint32_t *skip_link(struct ListedBl *bl, size_t level) {
+    return bl != NULL ? &bl->skip[level - 1] : &skip_heads[level - 1];
+}
+
+/* Function: insert_skip_bl
+ *
+ * Parameters:
+ * bl - payload of a small free block
+ * pl_size - its payload size
+ *
+ * This function inserts a block into the address-ordered list. It goes
+ * down the skip list from the top level, moving right while the next
+ * block is below bl and linking bl in on each level up to its height,
+ * then finishes the search on the list itself, which takes O(log n)
+ * steps on average.
+ */
+void insert_skip_bl(struct ListedBl *bl, size_t pl_size) {
+    uint32_t offset = offset_of(bl);
+    size_t height = skip_height(bl, pl_size);
+    struct ListedBl *prev = NULL;
+    for (size_t level = SKIP_LEVELS - 1; level > 0; level--) {
+        uint32_t *link = skip_link(prev, level);
+        while (*link != 0 && *link < offset) {
+            prev = listed_bl_at(*link);
+            link = skip_link(prev, level);
+        }
+        if (level < height) {
+            *skip_link(bl, level) = *link;
+            *link = offset;
+        }
+    }
+
+    struct ListedBl *next = prev != NULL ? listed_bl_at(prev->next) : first_listed_bl;
+    while (next != NULL && next < bl) {
+        prev = next;
+        next = listed_bl_at(next->next);
+    }
+    bl->prev = offset_of(prev);
+    bl->next = offset_of(next);
+    if (prev != NULL) {
+        prev->next = offset;
+    }
+    else {
+        first_listed_bl = bl;
+    }
+    if (next != NULL) {
+        next->prev = offset;
+    }
+}
+
+/* Function: unlink_skip_bl
+ *
+ * Parameters:
+ * bl - a block in the address-ordered list
+ * pl_size - its payload size
+ *
+ * This function takes the block off the upper skip list levels, searching
+ * for the block before it on each one. Most blocks are only on the list
+ * itself, which is doubly linked, so they need no search at all.
+ */
+void unlink_skip_bl(struct ListedBl *bl, size_t pl_size) {
+    size_t height = skip_height(bl, pl_size);
+    if (height == 1) {
+        return;
+    }
+    uint32_t offset = offset_of(bl);
+    struct ListedBl *prev = NULL;
+    for (size_t level = SKIP_LEVELS - 1; level > 0; level--) {
+        uint32_t *link = skip_link(prev, level);
+        while (*link != 0 && *link < offset) {
+            prev = listed_bl_at(*link);
+            link = skip_link(prev, level);
+        }
+        if (level < height) {
+            *link = *skip_link(bl, level);
+        }
+    }
 }
 
 /* Function: add_listed_bl
@@ -125,19 +688,36 @@ void *get_next_hdptr(void *cur_hdptr) {
  * Returns: 
  * pointer to listed block
  *
- * This function makes a free block and returns a pointer to its listed block
+ * This function makes a free block and returns a pointer to its listed block.
+ * The left neighbour of a free block is never free, so the header has no
+ * flags; the block's footer and its right neighbour's prev-free bit are set.
+ * Large blocks are indexed in the tree instead of the list.
  */
 struct ListedBl *add_listed_bl(void *hd, size_t pl_size) {
-    *(size_t *)hd = pl_size;
+    count_free_bl(pl_size, true);
+    *(header_t *)hd = HEADER_SIZE + pl_size;
+    *((header_t *)get_next_hdptr(hd) - 1) = HEADER_SIZE + pl_size;
+    set_prev_free(get_next_hdptr(hd), true);
+
+    if (pl_size >= TREE_MIN_SIZE) {
+        struct TreeBl *node = plptr_of(hd);
+        node->trim_epoch = trim_epoch;
+        insert_tree_bl(node, pl_size);
+        return plptr_of(hd);
+    }
 
-    //add block to the front of the list
     struct ListedBl *cur_bl = plptr_of(hd);
-    cur_bl->prev = NULL;
-    cur_bl->next = first_listed_bl;
+#if LIST_ORDER == ADDRESS_ORDER
+    insert_skip_bl(cur_bl, pl_size);
+#else
+    //add block to the front of the list
+    cur_bl->prev = 0;
+    cur_bl->next = offset_of(first_listed_bl);
     if (first_listed_bl != NULL) {
-        first_listed_bl->prev = cur_bl;
+        first_listed_bl->prev = offset_of(cur_bl);
     }
     first_listed_bl = cur_bl;
+#endif
 
     return cur_bl;
 }
@@ -156,17 +736,44 @@ struct ListedBl *add_listed_bl(void *hd, size_t pl_size) {
  * successful, or false otherwise. The myinit function can be 
  * called to reset the heap to an empty state. When running 
  * against a set of of test scripts, the test harness calls 
- * myinit before starting each new script.
+ * myinit before starting each new script. The first header goes 4 bytes
+ * into the heap, and the last 4 bytes are left over.
  */
 bool myinit(void *heap_start, size_t heap_size) {
-    if (heap_size < ALIGNMENT + sizeof(struct ListedBl)) {
+    if ((heap_size != 0 && heap_size < ALIGNMENT + HEADER_SIZE + MIN_PL_SIZE)
+        || heap_size > MAX_HEAP_SIZE) {
         return false;
     }
 
-    first_hd = heap_start;
-    total_size = heap_size;
+    heap_base = heap_start;
+    first_hd = heap_base + HEADER_SIZE;
+    total_size = heap_size > 0 ? (heap_size - ALIGNMENT) & ~(size_t)(ALIGNMENT - 1) : 0;
+    end_prev_free = false;
     first_listed_bl = NULL;
-    add_listed_bl(first_hd, total_size - ALIGNMENT);
+    memset(skip_heads, 0, sizeof(skip_heads));
+    tree_root = NULL;
+    rover = NULL;
+    memset(quick_lists, 0, sizeof(quick_lists));
+    memset(quick_idle, 0, sizeof(quick_idle));
+    nquick_bl = 0;
+    quick_pl_bytes = 0;
+    trim_epoch = 0;
+    freed_since_trim = 0;
+    ops_since_validate = 0;
+    nfree_bl = 0;
+    free_pl_bytes = 0;
+    memset(free_hist, 0, sizeof(free_hist));
+    memset(small_counts, 0, sizeof(small_counts));
+    nused_bl = 0;
+    nhuge_bl = 0;
+    huge_pl_bytes = 0;
+    nsplits = 0;
+    ncoalesces = 0;
+    nquick_allocs = 0;
+    nquick_frees = 0;
+    if (total_size > 0) {
+        add_listed_bl(first_hd, total_size - HEADER_SIZE);
+    }
     return true;
 }
 
@@ -175,19 +782,30 @@ bool myinit(void *heap_start, size_t heap_size) {
  * Parameters:
  * cur - pointer to the listed block to be removed
  *
- * This function removes a listed block from the list.
+ * This function removes a free block from the list or the tree.
  */
 void remove_listed_bl(struct ListedBl *cur) {
+    size_t pl_size = get_pl_size(hdptr_of(cur));
+    count_free_bl(pl_size, false);
+    if (pl_size >= TREE_MIN_SIZE) {
+        remove_tree_bl((struct TreeBl *)cur, pl_size);
+        return;
+    }
+#if LIST_ORDER == ADDRESS_ORDER
+    unlink_skip_bl(cur, pl_size);
+#endif
+    struct ListedBl *next = listed_bl_at(cur->next);
+    if (cur == rover) {
+        rover = next;
+    }
     if (cur == first_listed_bl) {
-        first_listed_bl = cur->next;
+        first_listed_bl = next;
     }
-    else {
-        if (cur->prev != NULL) {
-            cur->prev->next = cur->next;
-        }
-        if (cur->next != NULL) {
-            cur->next->prev = cur->prev;
-        }
+    else if (cur->prev != 0) {
+        listed_bl_at(cur->prev)->next = cur->next;
+    }
+    if (next != NULL) {
+        next->prev = cur->prev;
     }
 }
 
@@ -201,148 +819,839 @@ void remove_listed_bl(struct ListedBl *cur) {
  * Returns: 
  * pointer to the payload of the block
  *
- * This function resizes a block to fit the needed size most tightly possible.
+ * This function resizes a block to fit the needed size most tightly possible
+ * and marks it as allocated. The leftover tail becomes a free block, which
+ * is coalesced with its right neighbour if that one is free too.
  */
 void *resizesmaller(struct ListedBl *cur, size_t pl_size, size_t needed_size) {
     void *cur_hd = hdptr_of(cur);
+    header_t prev_free_bit = *(header_t *)cur_hd & PREV_FREE_BIT;
     
     if (isfree(cur_hd)) {
         remove_listed_bl(cur);
+        set_prev_free(get_next_hdptr(cur_hd), false);
     }
     //see if we can fit another free block
-    if (pl_size - needed_size >= ALIGNMENT + sizeof(struct ListedBl)) {
-        add_listed_bl((char *)cur + needed_size, pl_size - needed_size - ALIGNMENT);
-        *(size_t *)cur_hd = needed_size;
+    if (pl_size - needed_size >= MIN_SPLIT_SIZE) {
+        void *rest_hd = (char *)cur + needed_size;
+        size_t rest_size = pl_size - needed_size - HEADER_SIZE;
+        void *next_hd = (char *)rest_hd + HEADER_SIZE + rest_size;
+        if (in_heap(next_hd) && isfree(next_hd)) {
+            remove_listed_bl(plptr_of(next_hd));
+            rest_size += HEADER_SIZE + get_pl_size(next_hd);
+            ncoalesces++;
+        }
+        add_listed_bl(rest_hd, rest_size);
+        nsplits++;
+        pl_size = needed_size;
     }
 
-    *(size_t *)cur_hd = (*(size_t *)cur_hd) | 1;
+    *(header_t *)cur_hd = (HEADER_SIZE + pl_size) | prev_free_bit | ALLOC_BIT;
     return cur;
 }
 
-/* Function: firstfit
+/* Function: trim_bl
  *
  * Parameters:
- * needed_size - needed size to be allocated
+ * node - payload of a large free block
  *
  * Returns: 
- * pointer to the payload of the block that the needed size can fit in
+ * number of bytes given back to the OS
  *
- * This function finds a free block that can accommodate the needed size 
- * using first fit and then returns a pointer to its payload.
+ * This function releases the whole pages between the block's tree node
+ * and its footer and marks the block as trimmed.
  */
-void *firstfit(size_t needed_size) {
-
-    struct ListedBl *cur_bl = first_listed_bl;
-    void *cur_hd;
-    size_t pl_size;
-    
-    while (cur_bl != NULL) {
-        
-        cur_hd = hdptr_of(cur_bl);
-        pl_size = get_pl_size(cur_hd);
-        
-        if (pl_size >= needed_size) {            
-            return resizesmaller(cur_bl, pl_size, needed_size);           
-        }
-        cur_bl = cur_bl->next;
+size_t trim_bl(struct TreeBl *node) {
+    uintptr_t start = ((uintptr_t)(node + 1) + PAGE_SIZE - 1) & ~(uintptr_t)(PAGE_SIZE - 1);
+    uintptr_t end = ((uintptr_t)node + get_pl_size(hdptr_of(node)) - HEADER_SIZE)
+                    & ~(uintptr_t)(PAGE_SIZE - 1);
+    node->trim_epoch = TRIMMED_EPOCH;
+    if (end <= start || madvise((void *)start, end - start, MADV_DONTNEED) == -1) {
+        return 0;
     }
-    return NULL;
+    return end - start;
 }
 
-/* Function: mymalloc
+/* Function: trim_tree
  *
  * Parameters:
- * requested_size - requested size to be allocated
+ * node - root of a subtree
+ * before_epoch - only blocks freed before this trim epoch are trimmed
  *
  * Returns: 
- * pointer to the payload of the block that the requested size can fit in
+ * number of bytes given back to the OS
  *
- * This function alllocates the requested size 
- * and then returns a pointer to its payload.
+ * This function trims the blocks of at least TRIM_MIN_SIZE in the
+ * subtree, skipping left subtrees that only hold smaller blocks.
  */
-void *mymalloc(size_t requested_size) {
-    if (requested_size == 0 || requested_size > MAX_REQUEST_SIZE) {
-        return NULL;
-    }   
-    size_t needed_size = roundup_bl(requested_size, ALIGNMENT);
-    return firstfit(needed_size);
+size_t trim_tree(struct TreeBl *node, size_t before_epoch) {
+    size_t released = 0;
+    while (node != NULL) {
+        if (get_pl_size(hdptr_of(node)) >= TRIM_MIN_SIZE) {
+            released += trim_tree(node->left, before_epoch);
+            if (node->trim_epoch < before_epoch) {
+                released += trim_bl(node);
+            }
+        }
+        node = node->right;
+    }
+    return released;
 }
 
-/* Function: coalescefree
+/* Function: free_bl
  *
  * Parameters:
- * cur_hd - current header
- * next_hd - next header
- *
+ * cur_hd - pointer to the header of an allocated heap block
+ * pl_size - payload size to free, which may take in allocated blocks
+ *           right after the first one
  *
- * This function coalesces 2 neighboring free blocks. 
+ * This function turns the given span into one free block, coalescing it
+ * with its right neighbour and, through the footer of the block before
+ * it, with its left neighbour if either is free.
  */
-void coalescefree(void *cur_hd, void *next_hd) {
-    *(size_t *)cur_hd = *(size_t *)cur_hd + ALIGNMENT + *(size_t *)next_hd;
-    remove_listed_bl((struct ListedBl *)((char *)next_hd + ALIGNMENT));
+void free_bl(void *cur_hd, size_t pl_size) {
+    void *next_hd = (char *)plptr_of(cur_hd) + pl_size;
+    
+    if (in_heap(next_hd) && isfree(next_hd)) {
+        remove_listed_bl(plptr_of(next_hd));
+        pl_size += HEADER_SIZE + get_pl_size(next_hd);
+        ncoalesces++;
+    }
+    if (isprevfree(cur_hd)) {
+        void *prev_hd = get_prev_hdptr(cur_hd);
+        remove_listed_bl(plptr_of(prev_hd));
+        pl_size += HEADER_SIZE + get_pl_size(prev_hd);
+        cur_hd = prev_hd;
+        ncoalesces++;
+    }
+    add_listed_bl(cur_hd, pl_size);
+
+    //every so often, trim the large blocks freed before the last pass
+    if (pl_size >= TRIM_MIN_SIZE) {
+        freed_since_trim += pl_size;
+        if (freed_since_trim >= TRIM_HYSTERESIS) {
+            freed_since_trim = 0;
+            trim_tree(tree_root, trim_epoch++);
+        }
+    }
 }
 
-/* Function: myfree
+/* Function: quick_class
  *
  * Parameters:
- * ptr - pointer to the payload to be freed
+ * pl_size - payload size of a block
  *
- * This function frees a previously allocated block.
+ * Returns: 
+ * index of the quick list for blocks of that size
  */
-void myfree(void *ptr) {
-    if (ptr != NULL) {
-        void *cur_hd = (char *)ptr - ALIGNMENT;
-        
-        if (!isfree(cur_hd)) {
-            add_listed_bl(cur_hd, get_pl_size(cur_hd));
-            void *next_hd = get_next_hdptr(cur_hd);
-            
-            if (isfree(next_hd)) {
-                coalescefree(cur_hd, next_hd);
-            }
-        }
-    }
+size_t quick_class(size_t pl_size) {
+    return (HEADER_SIZE + pl_size) / ALIGNMENT;
 }
 
-/* Function: myrealloc
+/* Function: add_quick_bl
  *
  * Parameters:
- * old_ptr - pointer to the payload to be reallocated
- * new_size - the new size requested
+ * hd - pointer to the header of an allocated heap block
+ * pl_size - its payload size, at most QUICK_MAX_SIZE
  *
- * This function reallocates a previously allocated block.
+ * This function pushes a freed block on the quick list for its size. The
+ * header is left alone, so to its neighbours the block still looks
+ * allocated and nothing coalesces with it; it only counts as free in the
+ * running totals.
  */
-void *myrealloc(void *old_ptr, size_t new_size) {
-    if (old_ptr == NULL) {
-        return mymalloc(new_size);
+void add_quick_bl(void *hd, size_t pl_size) {
+    struct ListedBl *cur_bl = plptr_of(hd);
+    size_t class = quick_class(pl_size);
+    cur_bl->next = offset_of(quick_lists[class]);
+    quick_lists[class] = cur_bl;
+    quick_idle[class]++;
+    nquick_bl++;
+    quick_pl_bytes += pl_size;
+    count_free_bl(pl_size, true);
+}
+
+/* Function: take_quick_bl
+ *
+ * Parameters:
+ * needed_size - needed size to be allocated
+ *
+ * Returns: 
+ * pointer to the payload of a block popped from the quick list for
+ * exactly that size, or NULL if that list is empty
+ */
+void *take_quick_bl(size_t needed_size) {
+    size_t class = quick_class(needed_size);
+    struct ListedBl *cur_bl = quick_lists[class];
+    if (cur_bl == NULL) {
+        return NULL;
+    }
+    quick_lists[class] = listed_bl_at(cur_bl->next);
+    quick_idle[class] = 0;
+    nquick_bl--;
+    quick_pl_bytes -= needed_size;
+    count_free_bl(needed_size, false);
+    return cur_bl;
+}
+
+/* Function: sweep_quick_class
+ *
+ * Parameters:
+ * class - index of a quick list
+ *
+ * This function empties one quick list, freeing each block for real so
+ * it coalesces with whatever free neighbours it has by now.
+ */
+void sweep_quick_class(size_t class) {
+    while (quick_lists[class] != NULL) {
+        void *hd = hdptr_of(quick_lists[class]);
+        size_t pl_size = get_pl_size(hd);
+        take_quick_bl(pl_size);
+        free_bl(hd, pl_size);
+    }
+}
+
+/* Function: sweep_quick_lists
+ *
+ * This function empties all the quick lists.
+ */
+void sweep_quick_lists() {
+    for (size_t class = 0; class < QUICK_CLASSES && nquick_bl > 0; class++) {
+        sweep_quick_class(class);
+    }
+}
+
+/* Function: fit_listed_bl
+ *
+ * Parameters:
+ * needed_size - needed size to be allocated
+ *
+ * Returns: 
+ * a listed block that the needed size can fit in, or NULL
+ *
+ * This function searches the list with the placement policy picked by
+ * FIT_POLICY. Next fit starts at the rover and wraps around to the front
+ * of the list. Best fit stops early at an exact fit, and good fit also
+ * stops after GOOD_FIT_CANDIDATES blocks that fit.
+ */
+struct ListedBl *fit_listed_bl(size_t needed_size) {
+#if FIT_POLICY == NEXT_FIT
+    struct ListedBl *start = rover != NULL ? rover : first_listed_bl;
+    struct ListedBl *cur_bl = start;
+    while (cur_bl != NULL) {
+        if (get_pl_size(hdptr_of(cur_bl)) >= needed_size) {
+            rover = cur_bl;
+            return cur_bl;
+        }
+        cur_bl = cur_bl->next != 0 ? listed_bl_at(cur_bl->next) : first_listed_bl;
+        if (cur_bl == start) {
+            break;
+        }
+    }
+    return NULL;
+#elif FIT_POLICY == BEST_FIT || FIT_POLICY == GOOD_FIT
+    struct ListedBl *best = NULL;
+    size_t best_size = SIZE_MAX;
+    int ncandidates = 0;
+    for (struct ListedBl *cur_bl = first_listed_bl; cur_bl != NULL; cur_bl = listed_bl_at(cur_bl->next)) {
+        size_t pl_size = get_pl_size(hdptr_of(cur_bl));
+        if (pl_size >= needed_size && pl_size < best_size) {
+            best = cur_bl;
+            best_size = pl_size;
+            if (pl_size == needed_size) {
+                break;
+            }
+        }
+        if (pl_size >= needed_size && FIT_POLICY == GOOD_FIT
+            && ++ncandidates == GOOD_FIT_CANDIDATES) {
+            break;
+        }
+    }
+    return best;
+#else
+    for (struct ListedBl *cur_bl = first_listed_bl; cur_bl != NULL; cur_bl = listed_bl_at(cur_bl->next)) {
+        if (get_pl_size(hdptr_of(cur_bl)) >= needed_size) {
+            return cur_bl;
+        }
+    }
+    return NULL;
+#endif
+}
+
+/* Function: find_fit
+ *
+ * Parameters:
+ * needed_size - needed size to be allocated
+ *
+ * Returns: 
+ * pointer to the payload of the block that the needed size can fit in
+ *
+ * This function finds a free block that can accommodate the needed size 
+ * and then returns a pointer to its payload. Small sizes search the list
+ * and fall back to the tree; large sizes use best fit in the tree
+ * directly. If nothing fits, or only the last block of the heap does,
+ * the quick lists are swept and the search tried again.
+ */
+void *find_fit(size_t needed_size) {
+    struct ListedBl *cur_bl = NULL;
+    if (needed_size < TREE_MIN_SIZE) {
+        cur_bl = fit_listed_bl(needed_size);
+    }
+    if (cur_bl == NULL) {
+        cur_bl = (struct ListedBl *)bestfit_tree_bl(needed_size);
+    }
+    //the quick blocks are merged back before the end of the heap is used
+    if (nquick_bl > 0 && (cur_bl == NULL || !in_heap(get_next_hdptr(hdptr_of(cur_bl))))) {
+        sweep_quick_lists();
+        return find_fit(needed_size);
+    }
+    if (cur_bl == NULL) {
+        return NULL;
+    }
+    nused_bl++;
+    return resizesmaller(cur_bl, get_pl_size(hdptr_of(cur_bl)), needed_size);
+}
+
+/* Function: extend_heap
+ *
+ * Parameters:
+ * needed_size - payload size the heap must be able to hold at its end
+ *
+ * Returns: 
+ * whether the heap could grow
+ *
+ * This function commits more of the heap segment right after the end of
+ * the heap, at least HEAP_EXTEND_MIN bytes, and turns it into a free
+ * block of at least needed_size bytes. If the last block of the heap is
+ * free, the new memory is merged into it so less has to be committed.
+ * The segment grows by whole pages, which always covers the 4 bytes left
+ * over at each end of the heap as well.
+ */
+bool extend_heap(size_t needed_size) {
+    void *end = (char *)first_hd + total_size;
+    void *last_hd = end;
+    size_t last_size = 0;
+    if (end_prev_free) {
+        last_hd = get_prev_hdptr(end);
+        last_size = HEADER_SIZE + get_pl_size(last_hd);
+    }
+
+    size_t grow = ALIGNMENT + needed_size - last_size;
+    if (grow < HEAP_EXTEND_MIN) {
+        grow = HEAP_EXTEND_MIN;
+    }
+    char *segment_end = total_size > 0 ? (char *)end + HEADER_SIZE : heap_base;
+    if (segment_end + grow - heap_base > MAX_HEAP_SIZE) {
+        return false;
+    }
+    //the new memory is only usable if it continues this heap
+    if (extend_heap_segment(grow) != segment_end) {
+        return false;
+    }
+    segment_end = (char *)heap_segment_start() + heap_segment_size();
+    total_size = segment_end - HEADER_SIZE - (char *)first_hd;
+
+    if (end_prev_free) {
+        remove_listed_bl(plptr_of(last_hd));
+    }
+    add_listed_bl(last_hd, (char *)first_hd + total_size - (char *)last_hd - HEADER_SIZE);
+    return true;
+}
+
+/* Function: huge_pl_size
+ *
+ * Parameters:
+ * needed_size - needed size to be allocated
+ *
+ * Returns: 
+ * payload size of a huge block that holds needed_size bytes
+ *
+ * A huge block's mapping starts with 4 bytes of padding and the header,
+ * so the payload is aligned, and its payload takes up the rest of the
+ * last page but for the 4 bytes that keep the block size a multiple of
+ * ALIGNMENT.
+ */
+size_t huge_pl_size(size_t needed_size) {
+    size_t map_size = (ALIGNMENT + needed_size + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+    return map_size - ALIGNMENT - HEADER_SIZE;
+}
+
+/* Function: map_huge_bl
+ *
+ * Parameters:
+ * needed_size - needed size to be allocated
+ *
+ * Returns: 
+ * pointer to the payload of a new huge block, or NULL
+ *
+ * This function maps a huge block of its own. The payload takes up the
+ * rest of the last page, so the whole mapping can be reused by realloc.
+ */
+void *map_huge_bl(size_t needed_size) {
+    char *map = map_huge_segment(ALIGNMENT + needed_size);
+    if (map == NULL) {
+        return NULL;
+    }
+    void *hd = map + HEADER_SIZE;
+    size_t pl_size = huge_pl_size(needed_size);
+    *(header_t *)hd = (HEADER_SIZE + pl_size) | MMAPPED_BIT | ALLOC_BIT;
+    nhuge_bl++;
+    huge_pl_bytes += pl_size;
+    return plptr_of(hd);
+}
+
+/* Function: remap_huge_bl
+ *
+ * Parameters:
+ * hd - pointer to the header of a huge block
+ * needed_size - new payload size
+ *
+ * Returns: 
+ * pointer to the payload of the resized block, or NULL
+ *
+ * This function resizes the mapping of a huge block with mremap, which
+ * moves the pages instead of copying them if the mapping can't grow
+ * where it is.
+ */
+void *remap_huge_bl(void *hd, size_t needed_size) {
+    size_t old_size = get_pl_size(hd);
+    char *map = remap_huge_segment((char *)hd - HEADER_SIZE, ALIGNMENT + needed_size);
+    if (map == NULL) {
+        return NULL;
+    }
+    void *new_hd = map + HEADER_SIZE;
+    size_t pl_size = huge_pl_size(needed_size);
+    *(header_t *)new_hd = (HEADER_SIZE + pl_size) | MMAPPED_BIT | ALLOC_BIT;
+    huge_pl_bytes += pl_size - old_size;
+    return plptr_of(new_hd);
+}
+
+/* Function: unmap_huge_bl
+ *
+ * Parameters:
+ * hd - pointer to the header of a huge block
+ *
+ * This function gives the mapping of a huge block back to the OS.
+ */
+void unmap_huge_bl(void *hd) {
+    nhuge_bl--;
+    huge_pl_bytes -= get_pl_size(hd);
+    unmap_huge_segment((char *)hd - HEADER_SIZE);
+}
+
+/* Function: sample_validate
+ *
+ * With VALIDATE_INTERVAL set, this function validates the whole heap on
+ * every VALIDATE_INTERVAL-th call to mymalloc, myrealloc and myfree and
+ * aborts if it is broken, so that consistency checks can stay on in a
+ * long-running program at a fraction of their cost.
+ */
+void sample_validate() {
+#if VALIDATE_INTERVAL > 0
+    if (++ops_since_validate >= VALIDATE_INTERVAL) {
+        ops_since_validate = 0;
+        if (!validate_heap()) {
+            fprintf(stderr, "validate_heap failed during a sampled check.\n");
+            abort();
+        }
+    }
+#endif
+}
+
+/* Function: mymalloc
+ *
+ * Parameters:
+ * requested_size - requested size to be allocated
+ *
+ * Returns: 
+ * pointer to the payload of the block that the requested size can fit in
+ *
+ * This function alllocates the requested size 
+ * and then returns a pointer to its payload. A block of exactly the
+ * needed size on a quick list is taken first. If no free block fits,
+ * the heap is extended first. Huge requests are mapped on their own.
+ */
+void *mymalloc(size_t requested_size) {
+    sample_validate();
+    if (requested_size == 0 || requested_size > MAX_REQUEST_SIZE) {
+        return NULL;
+    }   
+    size_t needed_size = roundup_bl(requested_size, ALIGNMENT);
+    if (needed_size >= MMAP_THRESHOLD) {
+        return map_huge_bl(needed_size);
+    }
+    if (needed_size <= QUICK_MAX_SIZE) {
+        void *ptr = take_quick_bl(needed_size);
+        if (ptr != NULL) {
+            nused_bl++;
+            nquick_allocs++;
+            return ptr;
+        }
+    }
+    void *ptr = find_fit(needed_size);
+    if (ptr == NULL && extend_heap(needed_size)) {
+        ptr = find_fit(needed_size);
+    }
+    return ptr;
+}
+
+/* Function: mycalloc
+ *
+ * Parameters:
+ * nmemb - number of elements
+ * size - size of each element
+ *
+ * Returns: 
+ * pointer to the zeroed payload, or NULL
+ *
+ * This function allocates an array and clears it. A huge block comes
+ * straight from mmap and is already zero, so it isn't cleared again.
+ */
+void *mycalloc(size_t nmemb, size_t size) {
+    if (size != 0 && nmemb > MAX_REQUEST_SIZE / size) {
+        return NULL;
+    }
+    void *ptr = mymalloc(nmemb * size);
+    if (ptr != NULL && !ismapped(hdptr_of(ptr))) {
+        memset(ptr, 0, nmemb * size);
+    }
+    return ptr;
+}
+
+/* Function: mymemalign
+ *
+ * Parameters:
+ * alignment - required alignment of the payload, a power of two
+ * size - requested size
+ *
+ * Returns: 
+ * pointer to an aligned payload, or NULL
+ *
+ * This function allocates a block big enough to slide the payload up to
+ * an aligned address and still leave a free block in front of it. The
+ * leading slack is split off and freed straight into the list or tree,
+ * never onto a quick list, so it merges with a free left neighbour, and
+ * the tail is cut back to the needed size. Aligned blocks always come
+ * from the heap, never from a mapping of their own.
+ */
+void *mymemalign(size_t alignment, size_t size) {
+    sample_validate();
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0 || alignment > MAX_REQUEST_SIZE) {
+        return NULL;
+    }
+    if (alignment <= ALIGNMENT) {
+        return mymalloc(size);
+    }
+    if (size == 0 || size > MAX_REQUEST_SIZE) {
+        return NULL;
+    }
+    size_t needed_size = roundup_bl(size, ALIGNMENT);
+    size_t padded_size = needed_size + alignment + HEADER_SIZE + MIN_PL_SIZE;
+    void *ptr = find_fit(padded_size);
+    if (ptr == NULL && extend_heap(padded_size)) {
+        ptr = find_fit(padded_size);
+    }
+    if (ptr == NULL) {
+        return NULL;
+    }
+
+    void *hd = hdptr_of(ptr);
+    size_t pl_size = get_pl_size(hd);
+    if ((uintptr_t)ptr % alignment != 0) {
+        char *aligned = (char *)(((uintptr_t)ptr + HEADER_SIZE + MIN_PL_SIZE + alignment - 1)
+                                 & ~(uintptr_t)(alignment - 1));
+        size_t lead_size = aligned - (char *)ptr - HEADER_SIZE;
+        pl_size -= lead_size + HEADER_SIZE;
+        *(header_t *)hdptr_of(aligned) = (HEADER_SIZE + pl_size) | ALLOC_BIT;
+        free_bl(hd, lead_size);
+        ptr = aligned;
+    }
+    return resizesmaller(ptr, pl_size, needed_size);
+}
+
+/* Function: myusable_size
+ *
+ * Parameters:
+ * ptr - pointer to an allocated payload
+ *
+ * Returns: 
+ * how many bytes of the payload can be used
+ *
+ * This function returns the whole payload size, including the bytes that
+ * rounding added to the requested size.
+ */
+size_t myusable_size(void *ptr) {
+    if (ptr == NULL) {
+        return 0;
+    }
+    return get_pl_size(hdptr_of(ptr));
+}
+
+/* Function: mymalloc_batch
+ *
+ * Parameters:
+ * requested_size - requested size of each block
+ * n - number of blocks to allocate
+ * out - array that receives the payload pointers
+ *
+ * Returns: 
+ * number of blocks allocated, fewer than n only if memory ran out
+ *
+ * This function allocates n blocks of the same size with a single search:
+ * it takes one free block big enough for all of them (up to
+ * MAX_REQUEST_SIZE at a time) and writes a header every stride bytes, so
+ * the blocks end up side by side. The last block gets whatever slack was
+ * too small to split off. Huge sizes, and whatever is left when no region
+ * fits, are allocated one at a time.
+ */
+size_t mymalloc_batch(size_t requested_size, size_t n, void **out) {
+    sample_validate();
+    if (requested_size == 0 || requested_size > MAX_REQUEST_SIZE) {
+        return 0;
+    }
+    size_t needed_size = roundup_bl(requested_size, ALIGNMENT);
+    size_t stride = HEADER_SIZE + needed_size;
+    size_t max_count = (MAX_REQUEST_SIZE + HEADER_SIZE) / stride;
+    size_t done = 0;
+
+    while (needed_size < MMAP_THRESHOLD && done < n) {
+        size_t count = n - done < max_count ? n - done : max_count;
+        size_t region_size = count * stride - HEADER_SIZE;
+        void *ptr = find_fit(region_size);
+        if (ptr == NULL && extend_heap(region_size)) {
+            ptr = find_fit(region_size);
+        }
+        if (ptr == NULL) {
+            break;
+        }
+
+        char *hd = hdptr_of(ptr);
+        header_t prev_free_bit = *(header_t *)hd & PREV_FREE_BIT;
+        size_t last_size = get_pl_size(hd) - (count - 1) * stride;
+        for (size_t i = 0; i < count; i++) {
+            *(header_t *)hd = (HEADER_SIZE + (i + 1 < count ? needed_size : last_size)) | ALLOC_BIT;
+            out[done++] = plptr_of(hd);
+            hd += stride;
+        }
+        *(header_t *)hdptr_of(ptr) |= prev_free_bit;
+        nused_bl += count - 1;
+    }
+    for (; done < n; done++) {
+        out[done] = mymalloc(requested_size);
+        if (out[done] == NULL) {
+            break;
+        }
+    }
+    return done;
+}
+
+/* Function: myheap_stats
+ *
+ * Parameters:
+ * stats - where to store the snapshot
+ *
+ * This function reports the running totals kept as blocks come and go.
+ * The largest free block is the rightmost node of the tree or, if the
+ * tree is empty, comes from the counts of listed blocks by size, so the
+ * whole call takes O(log n) time. Blocks on the quick lists count as free.
+ */
+void myheap_stats(struct heap_stats *stats) {
+    size_t largest = 0;
+    if (tree_root != NULL) {
+        struct TreeBl *node = tree_root;
+        while (node->right != NULL) {
+            node = node->right;
+        }
+        largest = get_pl_size(hdptr_of(node));
+    }
+    else {
+        for (size_t i = TREE_MIN_SIZE / ALIGNMENT; i > 0; i--) {
+            if (small_counts[i - 1] > 0) {
+                largest = i * ALIGNMENT - HEADER_SIZE;
+                break;
+            }
+        }
+    }
+
+    stats->heap_bytes = total_size + nhuge_bl * (ALIGNMENT + HEADER_SIZE) + huge_pl_bytes;
+    stats->live_bytes = total_size - free_pl_bytes - (nused_bl + nfree_bl) * HEADER_SIZE + huge_pl_bytes;
+    stats->free_bytes = free_pl_bytes;
+    stats->live_blocks = nused_bl + nhuge_bl;
+    stats->free_blocks = nfree_bl;
+    stats->largest_free = largest;
+    memcpy(stats->free_histogram, free_hist, sizeof(free_hist));
+    stats->fragmentation = free_pl_bytes > 0 ? 1.0 - (double)largest / free_pl_bytes : 0;
+    stats->splits = nsplits;
+    stats->coalesces = ncoalesces;
+    stats->quick_allocs = nquick_allocs;
+    stats->quick_frees = nquick_frees;
+}
+
+/* Function: mytrim
+ *
+ * Returns: 
+ * number of bytes given back to the OS
+ *
+ * This function sweeps the quick lists, so their blocks can coalesce into
+ * large ones, then releases the pages inside every large free block.
+ */
+size_t mytrim() {
+    sweep_quick_lists();
+    freed_since_trim = 0;
+    trim_epoch++;
+    return trim_tree(tree_root, TRIMMED_EPOCH);
+}
+
+/* Function: myfree
+ *
+ * Parameters:
+ * ptr - pointer to the payload to be freed
+ *
+ * This function frees a previously allocated block. A small block goes
+ * on its quick list as it is, and the quick lists are swept once they
+ * hold QUICK_MAX_BYTES bytes. Any other block is coalesced with its right
+ * neighbour and, through the footer of the block before it, with its left
+ * neighbour if either is free. A huge block is unmapped right away.
+ */
+void myfree(void *ptr) {
+    sample_validate();
+    if (ptr != NULL) {
+        void *cur_hd = hdptr_of(ptr);
+        
+        if (ismapped(cur_hd)) {
+            unmap_huge_bl(cur_hd);
+        }
+        else if (!isfree(cur_hd)) {
+            nused_bl--;
+            size_t pl_size = get_pl_size(cur_hd);
+            if (pl_size <= QUICK_MAX_SIZE) {
+                add_quick_bl(cur_hd, pl_size);
+                nquick_frees++;
+                //a list that keeps growing without serving requests only
+                //blocks merges, so its blocks are freed for real
+                if (quick_idle[quick_class(pl_size)] >= QUICK_IDLE_FREES) {
+                    sweep_quick_class(quick_class(pl_size));
+                }
+                else if (quick_pl_bytes >= QUICK_MAX_BYTES) {
+                    sweep_quick_lists();
+                }
+            }
+            else {
+                free_bl(cur_hd, pl_size);
+            }
+        }
+    }
+}
+
+/* Function: compare_ptrs
+ *
+ * This function orders pointers by address, for qsort.
+ */
+int compare_ptrs(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t)*(void *const *)a;
+    uintptr_t y = (uintptr_t)*(void *const *)b;
+    return (x > y) - (x < y);
+}
+
+/* Function: myfree_batch
+ *
+ * Parameters:
+ * ptrs - array of payloads to be freed, sorted in place by address
+ *        unless it is sorted already
+ * n - number of payloads
+ *
+ * This function frees n blocks at once. Once the pointers are sorted, a
+ * run of blocks that sit right next to each other in the heap is freed as
+ * one block, so it takes one coalescing step and one list or tree insert
+ * however long the run is. NULL pointers and repeats are skipped.
+ */
+void myfree_batch(void **ptrs, size_t n) {
+    sample_validate();
+    //blocks from mymalloc_batch come in address order already
+    for (size_t i = 1; i < n; i++) {
+        if (compare_ptrs(&ptrs[i - 1], &ptrs[i]) > 0) {
+            qsort(ptrs, n, sizeof(void *), compare_ptrs);
+            break;
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (ptrs[i] == NULL || (i > 0 && ptrs[i] == ptrs[i - 1])) {
+            continue;
+        }
+        void *cur_hd = hdptr_of(ptrs[i]);
+        if (ismapped(cur_hd)) {
+            unmap_huge_bl(cur_hd);
+            continue;
+        }
+        if (isfree(cur_hd)) {
+            continue;
+        }
+        void *next_hd = get_next_hdptr(cur_hd);
+        nused_bl--;
+        while (i + 1 < n && ptrs[i + 1] != NULL && hdptr_of(ptrs[i + 1]) == next_hd) {
+            next_hd = get_next_hdptr(next_hd);
+            nused_bl--;
+            i++;
+        }
+        free_bl(cur_hd, (char *)next_hd - (char *)cur_hd - HEADER_SIZE);
+    }
+}
+
+/* Function: myrealloc
+ *
+ * Parameters:
+ * old_ptr - pointer to the payload to be reallocated
+ * new_size - the new size requested
+ *
+ * This function reallocates a previously allocated block. Huge blocks
+ * that stay huge are remapped; one that shrinks below MMAP_THRESHOLD
+ * moves back into the heap.
+ */
+void *myrealloc(void *old_ptr, size_t new_size) {
+    sample_validate();
+    if (old_ptr == NULL) {
+        return mymalloc(new_size);
     }
     else if (new_size == 0) {
         myfree(old_ptr);
         return NULL;
     }
+    else if (new_size > MAX_REQUEST_SIZE) {
+        return NULL;
+    }
 
     size_t needed_size = roundup_bl(new_size, ALIGNMENT);
     void *old_hd = hdptr_of(old_ptr);
     size_t old_size = get_pl_size(old_hd);
+    if (ismapped(old_hd)) {
+        if (needed_size >= MMAP_THRESHOLD) {
+            return remap_huge_bl(old_hd, needed_size);
+        }
+        void *new_ptr = mymalloc(new_size);
+        if (new_ptr != NULL) {
+            memcpy(new_ptr, old_ptr, new_size);
+            myfree(old_ptr);
+        }
+        return new_ptr;
+    }
     void *cur_hd = (char *)old_ptr + old_size;
     //if we can fit in the original block, resize it smaller
     if (needed_size <= old_size) {
         return resizesmaller(old_ptr, old_size, needed_size);
     }
-    //see if we can find and coalesce free blocks to the right
-    else if (((char *)cur_hd < ((char *)first_hd + total_size))
-             && isfree(cur_hd)) {
-        void *next_hd = get_next_hdptr(cur_hd);
-            
-        while (((char *)next_hd < ((char *)first_hd + total_size))
-               && isfree(next_hd)) {
-            coalescefree(cur_hd, next_hd);
-            next_hd = get_next_hdptr(cur_hd);
-        }
-        size_t combined_size = old_size + ALIGNMENT + get_pl_size(cur_hd);
+    //a right neighbour that only looks allocated because it sits on a quick
+    //list is freed for real, along with the rest of its list
+    if (in_heap(cur_hd) && !isfree(cur_hd) && get_pl_size(cur_hd) <= QUICK_MAX_SIZE
+        && quick_lists[quick_class(get_pl_size(cur_hd))] != NULL) {
+        sweep_quick_class(quick_class(get_pl_size(cur_hd)));
+    }
+    //see if we can grow into a free block to the right (free blocks are
+    //always coalesced, so there is at most one)
+    if (in_heap(cur_hd) && isfree(cur_hd)) {
+        size_t combined_size = old_size + HEADER_SIZE + get_pl_size(cur_hd);
         if (needed_size <= combined_size) {
             remove_listed_bl(plptr_of(cur_hd));
-            *(size_t *)old_hd = combined_size | 1;
+            *(header_t *)old_hd = (HEADER_SIZE + combined_size) | (*(header_t *)old_hd & PREV_FREE_BIT) | ALLOC_BIT;
+            set_prev_free(get_next_hdptr(old_hd), false);
             return resizesmaller(old_ptr, combined_size, needed_size);
         }
     }
@@ -355,11 +1664,192 @@ void *myrealloc(void *old_ptr, size_t new_size) {
     return new_ptr;
 }
 
+/* Function: footer_of
+ *
+ * Parameters:
+ * hdptr - pointer to the header of a free block
+ *
+ * Returns: 
+ * pointer to the block's footer
+ */
+header_t *footer_of(void *hdptr) {
+    return (header_t *)get_next_hdptr(hdptr) - 1;
+}
+
+/* Function: is_marked_bl
+ *
+ * Parameters:
+ * hdptr - supposed header of a free block, from the list or the tree
+ *
+ * Returns: 
+ * whether it is a free block that the heap walk of validate_heap marked
+ * and that hasn't been unmarked since
+ *
+ * validate_heap marks every free block it walks over by setting the
+ * footer's low bit (block sizes are multiples of ALIGNMENT), then
+ * unmarks each block it finds in the list or the tree, so a block that
+ * is reached twice, or a pointer that isn't a free block at all, shows up
+ * as unmarked. The pointer is checked against the heap bounds before it is
+ * followed.
+ */
+bool is_marked_bl(void *hdptr) {
+    char *heap_end = (char *)first_hd + total_size;
+    if ((char *)hdptr < (char *)first_hd || (char *)hdptr + HEADER_SIZE > heap_end
+        || (uintptr_t)plptr_of(hdptr) % ALIGNMENT != 0 || !isfree(hdptr)
+        || (char *)get_next_hdptr(hdptr) > heap_end) {
+        return false;
+    }
+    return *footer_of(hdptr) == (*(header_t *)hdptr | FOOTER_MARK);
+}
+
+/* Function: clear_marks
+ *
+ * Parameters:
+ * end_hd - header at which to stop
+ *
+ * Returns: 
+ * header of the first free block that was still marked, or NULL
+ *
+ * This function walks the heap up to end_hd and unmarks every free block,
+ * so that validate_heap leaves the footers as it found them.
+ */
+void *clear_marks(void *end_hd) {
+    void *first_marked = NULL;
+    for (void *cur_hd = first_hd; (char *)cur_hd < (char *)end_hd; cur_hd = get_next_hdptr(cur_hd)) {
+        if (isfree(cur_hd) && (*footer_of(cur_hd) & FOOTER_MARK)) {
+            *footer_of(cur_hd) &= ~(header_t)FOOTER_MARK;
+            if (first_marked == NULL) {
+                first_marked = cur_hd;
+            }
+        }
+    }
+    return first_marked;
+}
+
+/* Function: validate_tree
+ *
+ * Parameters:
+ * node - root of a subtree
+ * prevp - the node visited just before this subtree, updated in order
+ * countp - number of nodes visited, updated
+ *
+ * Returns: 
+ * whether the subtree is a valid treap of large free blocks
+ *
+ * This function checks the subtree with an in-order walk, unmarking each
+ * block it visits.
+ */
+bool validate_tree(struct TreeBl *node, struct TreeBl **prevp, size_t *countp) {
+    if (node == NULL) {
+        return true;
+    }
+    void *hd = hdptr_of(node);
+    if (!is_marked_bl(hd)) {
+        printf("Tree block at address %p is not a free block or is in the tree twice.\n", hd);
+        return false;
+    }
+    *footer_of(hd) &= ~(header_t)FOOTER_MARK;
+    if (get_pl_size(hd) < TREE_MIN_SIZE) {
+        printf("Tree block at address %p is not a large free block.\n", hd);
+        return false;
+    }
+    if (!validate_tree(node->left, prevp, countp)) {
+        return false;
+    }
+    if (*prevp != NULL && !tree_less(get_pl_size(hdptr_of(*prevp)), *prevp, node)) {
+        printf("Tree block at address %p is out of order.\n", hd);
+        return false;
+    }
+    if ((node->left != NULL && tree_priority(node->left) > tree_priority(node))
+        || (node->right != NULL && tree_priority(node->right) > tree_priority(node))) {
+        printf("Tree block at address %p has a child with a higher priority.\n", hd);
+        return false;
+    }
+    *prevp = node;
+    (*countp)++;
+    return validate_tree(node->right, prevp, countp);
+}
+
+/* Function: validate_quick_lists
+ *
+ * Returns: 
+ * whether the quick lists hold nquick_bl blocks of quick_pl_bytes bytes,
+ * each a block of the heap that looks allocated and has the size of its
+ * list
+ *
+ * A list is followed for at most nquick_bl blocks, so a cycle shows up as
+ * a wrong count instead of hanging.
+ */
+bool validate_quick_lists() {
+    size_t count = 0;
+    size_t pl_bytes = 0;
+    for (size_t class = 0; class < QUICK_CLASSES; class++) {
+        for (struct ListedBl *cur_bl = quick_lists[class]; cur_bl != NULL; cur_bl = listed_bl_at(cur_bl->next)) {
+            void *hd = hdptr_of(cur_bl);
+            if ((char *)hd < (char *)first_hd || !in_heap(hd) || (uintptr_t)cur_bl % ALIGNMENT != 0
+                || isfree(hd) || ismapped(hd) || quick_class(get_pl_size(hd)) != class) {
+                printf("Quick list block at address %p is not an unmerged block of its list's size.\n", hd);
+                return false;
+            }
+            if (++count > nquick_bl) {
+                printf("The quick lists hold more blocks than were put on them.\n");
+                return false;
+            }
+            pl_bytes += get_pl_size(hd);
+        }
+    }
+    if (count != nquick_bl || pl_bytes != quick_pl_bytes) {
+        printf("Running totals of the quick lists don't match the lists.\n");
+        return false;
+    }
+    return true;
+}
+
+/* Function: validate_skip_levels
+ *
+ * Returns: 
+ * whether each skip list level holds exactly the listed blocks that are
+ * tall enough for it, in address order
+ *
+ * Each level is walked side by side with the one below it, which has been
+ * checked already, so a block that is missing from a level, or a link to
+ * something that isn't on the level below, shows up as a mismatch.
+ */
+bool validate_skip_levels() {
+    for (size_t level = 1; level < SKIP_LEVELS; level++) {
+        uint32_t upper = skip_heads[level - 1];
+        struct ListedBl *lower = level > 1 ? listed_bl_at(skip_heads[level - 2]) : first_listed_bl;
+        while (lower != NULL) {
+            bool on_level = skip_height(lower, get_pl_size(hdptr_of(lower))) > level;
+            if (on_level != (upper == offset_of(lower))) {
+                printf("Listed block at address %p is %s skip list level %zu.\n",
+                       hdptr_of(lower), on_level ? "missing from" : "too short for", level);
+                return false;
+            }
+            if (on_level) {
+                upper = *skip_link(lower, level);
+            }
+            lower = listed_bl_at(level > 1 ? *skip_link(lower, level - 1) : lower->next);
+        }
+        if (upper != 0) {
+            printf("Skip list level %zu links to a block that isn't listed.\n", level);
+            return false;
+        }
+    }
+    return true;
+}
+
 /* Function: validate_heap
  *
  * Return true if all is ok, or false otherwise.
  * This function is called periodically by the test
  * harness to check the state of the heap allocator.
+ * It walks the heap once, marking every free block, then walks the list
+ * and the tree once each, unmarking the blocks they hold, so it takes
+ * linear time; a free block left marked at the end is in neither.
+ * Blocks on the quick lists look allocated to the heap walk, so they are
+ * counted separately. In address order, the list must also be sorted and
+ * its skip list levels must match it.
  */
 bool validate_heap() {
     void *cur_hd = first_hd;
@@ -367,8 +1857,15 @@ bool validate_heap() {
     size_t pl_free = 0;
     size_t nused = 0;
     size_t nfree = 0;
+    bool prev_free = false;
     
     while ((char *)cur_hd < (char *)first_hd + total_size) {        
+        if (isprevfree(cur_hd) != prev_free) {
+            printf("Block at address %p has a wrong prev-free bit.\n", cur_hd);
+            clear_marks(cur_hd);
+            breakpoint();
+            return false;
+        }
         if (!isfree(cur_hd)) {
             pl_used += get_pl_size(cur_hd);
             nused ++;
@@ -376,55 +1873,107 @@ bool validate_heap() {
         else {
             pl_free += get_pl_size(cur_hd);
             nfree ++;
-            struct ListedBl *cur_bl = first_listed_bl;
-            int count = 0;
-            while (cur_bl != NULL) {
-                if (cur_hd == (char *)cur_bl - ALIGNMENT) {
-                    count ++;
-                }
-                cur_bl = cur_bl->next;
-            }
-            if (count == 0) {
-                printf("Free block at address %p is not in the free list.\n", cur_hd);
+            if (prev_free) {
+                printf("Free block at address %p was not coalesced with the block before it.\n", cur_hd);
+                clear_marks(cur_hd);
                 breakpoint();
                 return false;
             }
-            if (count > 1) {
-                printf("Free block at address %p is listed more than once in the free list.\n", cur_hd);
+            if ((char *)get_next_hdptr(cur_hd) > (char *)first_hd + total_size
+                || *footer_of(cur_hd) != *(header_t *)cur_hd) {
+                printf("Free block at address %p has a footer that doesn't match its header.\n", cur_hd);
+                clear_marks(cur_hd);
                 breakpoint();
                 return false;
             }
-            
+            *footer_of(cur_hd) |= FOOTER_MARK;
         }
 
+        prev_free = isfree(cur_hd);
         cur_hd = get_next_hdptr(cur_hd);   
     }
+    void *heap_end = cur_hd;
+    if (end_prev_free != prev_free) {
+        printf("The end of the heap has a wrong prev-free bit.\n");
+        clear_marks(heap_end);
+        breakpoint();
+        return false;
+    }
 
-    if (pl_used + nused * ALIGNMENT > total_size) {
+    if (pl_used + nused * HEADER_SIZE > total_size) {
         printf("Used more heap than available.\n");
+        clear_marks(heap_end);
         breakpoint();
         return false;
     }
-    if (pl_used + pl_free + (nused + nfree) * ALIGNMENT != total_size) {
+    if (pl_used + pl_free + (nused + nfree) * HEADER_SIZE != total_size) {
         printf("Sum of all block sizes doesn't match total size of the heap.\n");
+        clear_marks(heap_end);
+        breakpoint();
+        return false;
+    }
+    if (!validate_quick_lists()) {
+        clear_marks(heap_end);
+        breakpoint();
+        return false;
+    }
+    if (nused != nused_bl + nquick_bl || nfree + nquick_bl != nfree_bl
+        || pl_free + quick_pl_bytes != free_pl_bytes) {
+        printf("Running totals of heap blocks don't match the heap.\n");
+        clear_marks(heap_end);
         breakpoint();
         return false;
     }
     
     struct ListedBl *cur_bl = first_listed_bl;
-    int list_length = 0;
+    struct ListedBl *prev_bl = NULL;
+    size_t list_length = 0;
     while (cur_bl != NULL) {
-        list_length ++;
         cur_hd = hdptr_of(cur_bl);
-        if (!isfree(cur_hd)) {
-            printf("Not all blocks in the free list are marked as free.\n");
+        if (!is_marked_bl(cur_hd)) {
+            printf("Listed block at address %p is not a free block or is listed more than once.\n", cur_hd);
+            clear_marks(heap_end);
+            breakpoint();
+            return false;
+        }
+        *footer_of(cur_hd) &= ~(header_t)FOOTER_MARK;
+        list_length ++;
+        if (get_pl_size(cur_hd) >= TREE_MIN_SIZE) {
+            printf("Free block at address %p is large but in the list.\n", cur_hd);
+            clear_marks(heap_end);
+            breakpoint();
+            return false;
+        }
+        if (cur_bl->prev != offset_of(prev_bl)) {
+            printf("Listed block at address %p has a wrong prev link.\n", cur_hd);
+            clear_marks(heap_end);
             breakpoint();
             return false;
-        }    
-        cur_bl = cur_bl->next;
+        }
+        if (LIST_ORDER == ADDRESS_ORDER && cur_bl < prev_bl) {
+            printf("Listed block at address %p is out of address order.\n", cur_hd);
+            clear_marks(heap_end);
+            breakpoint();
+            return false;
+        }
+        prev_bl = cur_bl;
+        cur_bl = listed_bl_at(cur_bl->next);
+    }
+    if (LIST_ORDER == ADDRESS_ORDER && !validate_skip_levels()) {
+        clear_marks(heap_end);
+        breakpoint();
+        return false;
+    }
+    struct TreeBl *prev_node = NULL;
+    size_t tree_size = 0;
+    if (!validate_tree(tree_root, &prev_node, &tree_size)) {
+        clear_marks(heap_end);
+        breakpoint();
+        return false;
     }
-    if (list_length != nfree) {
-        printf("Length of the free list doesn't match the count of free blocks.\n");
+    if (list_length + tree_size != nfree) {
+        printf("Free block at address %p is in neither the free list nor the tree.\n",
+               clear_marks(heap_end));
         breakpoint();
         return false;
     }
@@ -440,13 +1989,20 @@ void dump_heap() {
            first_hd, (char *)first_hd + total_size);
     void *cur = first_hd;
     while ((char *)cur < (char *)first_hd + total_size) {
-        printf("\n%p: ", cur);
-        printf("%lu ", *(size_t *)cur);
+        printf("\n%p: %lu %s", cur, get_pl_size(cur), isfree(cur) ? "free" : "used");
+        cur = get_next_hdptr(cur);
     }
-    printf("The explicit list of free blocks is below:\n");
+    printf("\nThe explicit list of free blocks is below:");
     struct ListedBl *cur_bl = first_listed_bl;
     while (cur_bl != NULL) {
         printf("\n%p", cur_bl);
-        cur_bl = cur_bl->next;
+        cur_bl = listed_bl_at(cur_bl->next);
+    }
+    printf("\nThe quick lists are below:");
+    for (size_t class = 0; class < QUICK_CLASSES; class++) {
+        for (cur_bl = quick_lists[class]; cur_bl != NULL; cur_bl = listed_bl_at(cur_bl->next)) {
+            printf("\n%p: %lu", cur_bl, get_pl_size(hdptr_of(cur_bl)));
+        }
     }
+    printf("\n");
 }
@@ -0,0 +1,469 @@
+/* File: gen_script.c
+ * ------------------
+ * Generates allocator scripts in the a/r/f format read by test_harness
+ * from a parameterized workload model, so that the allocators can be run
+ * on traces far longer than anything written by hand. Requests are
+ * written out as they are generated and only the live blocks are kept in
+ * memory, so traces of hundreds of millions of requests are fine.
+ *
+ * The model has four parts:
+ *  -- a size distribution for new blocks (-s): uniform, bounded power
+ *     law, bimodal, or a histogram recorded from a real program
+ *  -- a lifetime policy (-l) choosing which live block is freed: the
+ *     youngest (lifo), the oldest (fifo), any (random) or, for a long
+ *     tail, the youngest of a few random picks, so most blocks die young
+ *     but a few live very long
+ *  -- realloc growth chains (-c): a new block sometimes starts a chain of
+ *     reallocs that grow it step by step, like a vector being appended to
+ *  -- a target peak live set (-p): the chance that a request allocates
+ *     rather than frees falls from 1 with nothing live to 1/2 just below
+ *     the target, and at the target blocks are only freed, so the live
+ *     set climbs to the target and then hovers just under it
+ * Block ids are reused once freed, so the harness only needs as many ids
+ * as there are live blocks at once. All remaining blocks are freed at the
+ * end.
+ *
+ * Usage: gen_script [-n requests] [-s size_model] [-l lifetime] [-p peak_bytes]
+ *                   [-c prob:growth:length] [-S seed] [-o file]
+ * Size models: uniform:MIN:MAX, powerlaw:MIN:MAX:ALPHA,
+ *              bimodal:SMALL_MIN:SMALL_MAX:LARGE_MIN:LARGE_MAX:LARGE_FRACTION,
+ *              histogram:FILE (lines of "size count")
+ */
+
+#include <error.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "allocator.h"
+
+// how many random live blocks a long-tail free picks the youngest from
+#define LONGTAIL_PICKS 4
+
+enum size_model { UNIFORM, POWERLAW, BIMODAL, HISTOGRAM };
+enum lifetime { LIFO, FIFO, RANDOM, LONGTAIL };
+
+// struct for the parameters of the size distribution
+typedef struct {
+    enum size_model model;
+    size_t min, max;                // range of uniform and power-law sizes
+    double alpha;                   // power-law exponent
+    size_t large_min, large_max;    // bimodal: min and max are the small mode
+    double large_fraction;          // bimodal: share of large blocks
+    size_t *hist_sizes;             // histogram: sizes and cumulative counts
+    uint64_t *hist_cumulative;
+    int hist_len;
+} size_dist_t;
+
+// struct for one live block
+typedef struct {
+    size_t size;
+    uint64_t birth;     // request number at which it was allocated
+} block_t;
+
+// struct for the state of the generator while it runs
+typedef struct {
+    uint64_t rng;
+    block_t *blocks;            // indexed by id
+    int num_ids;                // ids handed out so far
+    int *free_ids;              // stack of ids that can be reused
+    int num_free_ids;
+    int *live;                  // ring buffer of live ids, oldest first
+    int live_head;
+    int num_live;
+    int capacity;               // size of all three arrays, a power of two
+    size_t live_bytes;
+    int chain_id;               // block being grown by a realloc chain, or -1
+    int chain_left;             // reallocs left in the chain
+} gen_t;
+
+// Output buffer, so each request costs a few stores instead of a printf
+static char outbuf[1 << 16];
+static size_t outlen;
+static FILE *outfp;
+
+/* Function: next_random
+ * ---------------------
+ * xorshift64* generator, much faster than rand() for long traces.
+ */
+static uint64_t next_random(gen_t *g) {
+    g->rng ^= g->rng >> 12;
+    g->rng ^= g->rng << 25;
+    g->rng ^= g->rng >> 27;
+    return g->rng * 0x2545F4914F6CDD1DUL;
+}
+
+/* Function: random_unit
+ * ---------------------
+ * Uniform double in [0, 1).
+ */
+static double random_unit(gen_t *g) {
+    return (next_random(g) >> 11) * (1.0 / (1UL << 53));
+}
+
+/* Function: random_range
+ * ----------------------
+ * Uniform integer in [lo, hi].
+ */
+static size_t random_range(gen_t *g, size_t lo, size_t hi) {
+    return lo + next_random(g) % (hi - lo + 1);
+}
+
+/* Function: random_size
+ * ---------------------
+ * Draws a block size from the size distribution.
+ */
+static size_t random_size(gen_t *g, size_dist_t *dist) {
+    if (dist->model == UNIFORM) {
+        return random_range(g, dist->min, dist->max);
+    } else if (dist->model == POWERLAW) {
+        // inverse of the CDF of a Pareto distribution cut off at min and max
+        double lo = pow(dist->min, -dist->alpha);
+        double hi = pow(dist->max + 1, -dist->alpha);
+        size_t size = pow(lo - random_unit(g) * (lo - hi), -1 / dist->alpha);
+        return size < dist->min ? dist->min : size > dist->max ? dist->max : size;
+    } else if (dist->model == BIMODAL) {
+        if (random_unit(g) < dist->large_fraction) {
+            return random_range(g, dist->large_min, dist->large_max);
+        }
+        return random_range(g, dist->min, dist->max);
+    } else {
+        uint64_t target = next_random(g) % dist->hist_cumulative[dist->hist_len - 1];
+        int lo = 0, hi = dist->hist_len - 1;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (dist->hist_cumulative[mid] > target) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+        return dist->hist_sizes[lo];
+    }
+}
+
+/* Function: emit
+ * --------------
+ * Appends one request to the output: op is 'a', 'r' or 'f' and the size
+ * is left out for frees.
+ */
+static void emit(char op, int id, size_t size) {
+    if (outlen > sizeof(outbuf) - 64) {
+        fwrite(outbuf, 1, outlen, outfp);
+        outlen = 0;
+    }
+    char digits[24];
+    outbuf[outlen++] = op;
+    size_t values[2] = {id, size};
+    for (int v = 0; v < (op == 'f' ? 1 : 2); v++) {
+        int n = 0;
+        do {
+            digits[n++] = '0' + values[v] % 10;
+            values[v] /= 10;
+        } while (values[v] > 0);
+        outbuf[outlen++] = ' ';
+        while (n > 0) {
+            outbuf[outlen++] = digits[--n];
+        }
+    }
+    outbuf[outlen++] = '\n';
+}
+
+/* Function: grow_arrays
+ * ---------------------
+ * Doubles the capacity of the id-indexed arrays and the live ring buffer,
+ * unwrapping the ring so that it starts at index 0 again.
+ */
+static void grow_arrays(gen_t *g) {
+    int capacity = g->capacity * 2;
+    int *live = malloc(capacity * sizeof(int));
+    g->blocks = realloc(g->blocks, capacity * sizeof(block_t));
+    g->free_ids = realloc(g->free_ids, capacity * sizeof(int));
+    if (live == NULL || g->blocks == NULL || g->free_ids == NULL) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+    for (int i = 0; i < g->num_live; i++) {
+        live[i] = g->live[(g->live_head + i) & (g->capacity - 1)];
+    }
+    free(g->live);
+    g->live = live;
+    g->live_head = 0;
+    g->capacity = capacity;
+}
+
+/* Function: do_alloc
+ * ------------------
+ * Allocates a new block, reusing a freed id if there is one, and maybe
+ * starts a realloc chain on it.
+ */
+static void do_alloc(gen_t *g, uint64_t req, size_dist_t *dist, double chain_prob,
+                     int chain_length) {
+    if (g->num_live == g->capacity || g->num_ids == g->capacity) {
+        grow_arrays(g);
+    }
+    int id = g->num_free_ids > 0 ? g->free_ids[--g->num_free_ids] : g->num_ids++;
+    size_t size = random_size(g, dist);
+    g->blocks[id] = (block_t){.size = size, .birth = req};
+    g->live[(g->live_head + g->num_live++) & (g->capacity - 1)] = id;
+    g->live_bytes += size;
+    emit('a', id, size);
+
+    if (g->chain_id < 0 && chain_prob > 0 && random_unit(g) < chain_prob) {
+        g->chain_id = id;
+        g->chain_left = chain_length;
+    }
+}
+
+/* Function: do_realloc
+ * --------------------
+ * Grows the block of the current realloc chain by the growth factor,
+ * ending the chain when it has no reallocs left or hits the size limit.
+ */
+static void do_realloc(gen_t *g, double growth) {
+    block_t *b = &g->blocks[g->chain_id];
+    size_t size = b->size * growth > b->size ? b->size * growth : b->size + 1;
+    if (size > MAX_REQUEST_SIZE) {
+        g->chain_id = -1;
+        return;
+    }
+    g->live_bytes += size - b->size;
+    b->size = size;
+    emit('r', g->chain_id, size);
+    if (--g->chain_left == 0) {
+        g->chain_id = -1;
+    }
+}
+
+/* Function: do_free
+ * -----------------
+ * Frees the live block chosen by the lifetime policy.
+ */
+static void do_free(gen_t *g, enum lifetime lifetime) {
+    int mask = g->capacity - 1;
+    int index;      // position of the victim counted from the oldest block
+    if (lifetime == LIFO) {
+        index = g->num_live - 1;
+    } else if (lifetime == FIFO) {
+        index = 0;
+    } else {
+        index = next_random(g) % g->num_live;
+        for (int pick = 1; lifetime == LONGTAIL && pick < LONGTAIL_PICKS; pick++) {
+            int other = next_random(g) % g->num_live;
+            if (g->blocks[g->live[(g->live_head + other) & mask]].birth
+                > g->blocks[g->live[(g->live_head + index) & mask]].birth) {
+                index = other;
+            }
+        }
+    }
+
+    int id = g->live[(g->live_head + index) & mask];
+    if (index == 0) {
+        g->live_head = (g->live_head + 1) & mask;
+    } else {
+        // order only matters at the ends, so fill the hole with the youngest
+        g->live[(g->live_head + index) & mask] = g->live[(g->live_head + g->num_live - 1) & mask];
+    }
+    g->num_live--;
+    g->live_bytes -= g->blocks[id].size;
+    g->free_ids[g->num_free_ids++] = id;
+    if (id == g->chain_id) {
+        g->chain_id = -1;
+    }
+    emit('f', id, 0);
+}
+
+/* Function: parse_bytes
+ * ---------------------
+ * Parses a byte count with an optional K, M or G suffix.
+ */
+static size_t parse_bytes(const char *str) {
+    char *end;
+    double value = strtod(str, &end);
+    if (*end == 'K' || *end == 'k') {
+        value *= 1 << 10;
+    } else if (*end == 'M' || *end == 'm') {
+        value *= 1 << 20;
+    } else if (*end == 'G' || *end == 'g') {
+        value *= 1 << 30;
+    } else if (*end != '\0') {
+        error(1, 0, "Bad byte count \"%s\".", str);
+    }
+    return value;
+}
+
+/* Function: load_histogram
+ * ------------------------
+ * Reads a recorded size histogram, one "size count" pair per line, into
+ * the size distribution.
+ */
+static void load_histogram(const char *path, size_dist_t *dist) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        error(1, 0, "Could not open histogram file \"%s\".", path);
+    }
+    int capacity = 0;
+    size_t size;
+    uint64_t count, total = 0;
+    dist->hist_len = 0;
+    while (fscanf(fp, "%zu %lu", &size, &count) == 2) {
+        if (size == 0 || size > MAX_REQUEST_SIZE || count == 0) {
+            continue;
+        }
+        if (dist->hist_len == capacity) {
+            capacity = capacity == 0 ? 64 : 2 * capacity;
+            dist->hist_sizes = realloc(dist->hist_sizes, capacity * sizeof(size_t));
+            dist->hist_cumulative = realloc(dist->hist_cumulative, capacity * sizeof(uint64_t));
+            if (dist->hist_sizes == NULL || dist->hist_cumulative == NULL) {
+                error(1, 0, "Libc heap exhausted. Cannot continue.");
+            }
+        }
+        total += count;
+        dist->hist_sizes[dist->hist_len] = size;
+        dist->hist_cumulative[dist->hist_len++] = total;
+    }
+    fclose(fp);
+    if (dist->hist_len == 0) {
+        error(1, 0, "Histogram file \"%s\" has no usable sizes.", path);
+    }
+}
+
+/* Function: parse_size_model
+ * --------------------------
+ * Parses the -s argument into a size distribution.
+ */
+static size_dist_t parse_size_model(char *arg) {
+    size_dist_t dist = {.model = UNIFORM};
+    char *name = strtok(arg, ":");
+    char *fields[5];
+    int nfields = 0;
+    for (char *field; nfields < 5 && (field = strtok(NULL, ":")) != NULL; ) {
+        fields[nfields++] = field;
+    }
+
+    if (strcmp(name, "uniform") == 0 && nfields == 2) {
+        dist.model = UNIFORM;
+    } else if (strcmp(name, "powerlaw") == 0 && nfields == 3) {
+        dist.model = POWERLAW;
+        dist.alpha = atof(fields[2]);
+        if (dist.alpha <= 0) {
+            error(1, 0, "Power-law exponent must be positive.");
+        }
+    } else if (strcmp(name, "bimodal") == 0 && nfields == 5) {
+        dist.model = BIMODAL;
+        dist.large_min = parse_bytes(fields[2]);
+        dist.large_max = parse_bytes(fields[3]);
+        dist.large_fraction = atof(fields[4]);
+        if (dist.large_min == 0 || dist.large_min > dist.large_max
+            || dist.large_max > MAX_REQUEST_SIZE) {
+            error(1, 0, "Bad large size range %zu-%zu.", dist.large_min, dist.large_max);
+        }
+    } else if (strcmp(name, "histogram") == 0 && nfields == 1) {
+        dist.model = HISTOGRAM;
+        load_histogram(fields[0], &dist);
+        return dist;
+    } else {
+        error(1, 0, "Bad size model \"%s\".", name);
+    }
+    dist.min = parse_bytes(fields[0]);
+    dist.max = parse_bytes(fields[1]);
+    if (dist.min == 0 || dist.min > dist.max || dist.max > MAX_REQUEST_SIZE) {
+        error(1, 0, "Bad size range %zu-%zu.", dist.min, dist.max);
+    }
+    return dist;
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t num_requests = 100000;
+    char default_model[] = "uniform:1:4096";
+    size_dist_t dist = {0};
+    bool have_dist = false;
+    enum lifetime lifetime = RANDOM;
+    size_t peak_bytes = 1 << 24;
+    double chain_prob = 0, growth = 1.5;
+    int chain_length = 0;
+    uint64_t seed = 1;
+    const char *out_path = NULL;
+
+    int c;
+    while ((c = getopt(argc, argv, "n:s:l:p:c:S:o:")) != -1) {
+        if (c == 'n') {
+            num_requests = strtoull(optarg, NULL, 10);
+        } else if (c == 's') {
+            dist = parse_size_model(optarg);
+            have_dist = true;
+        } else if (c == 'l') {
+            if (strcmp(optarg, "lifo") == 0) {
+                lifetime = LIFO;
+            } else if (strcmp(optarg, "fifo") == 0) {
+                lifetime = FIFO;
+            } else if (strcmp(optarg, "random") == 0) {
+                lifetime = RANDOM;
+            } else if (strcmp(optarg, "longtail") == 0) {
+                lifetime = LONGTAIL;
+            } else {
+                error(1, 0, "Lifetime must be lifo, fifo, random or longtail.");
+            }
+        } else if (c == 'p') {
+            peak_bytes = parse_bytes(optarg);
+        } else if (c == 'c') {
+            if (sscanf(optarg, "%lf:%lf:%d", &chain_prob, &growth, &chain_length) != 3
+                || chain_prob < 0 || chain_prob > 1 || growth <= 1 || chain_length < 1) {
+                error(1, 0, "Realloc chains are given as prob:growth:length, "
+                      "with growth above 1 and length at least 1.");
+            }
+        } else if (c == 'S') {
+            seed = strtoull(optarg, NULL, 10);
+        } else if (c == 'o') {
+            out_path = optarg;
+        } else {
+            error(1, 0, "Usage: %s [-n requests] [-s size_model] [-l lifetime] [-p peak_bytes] "
+                  "[-c prob:growth:length] [-S seed] [-o file]", argv[0]);
+        }
+    }
+    if (!have_dist) {
+        dist = parse_size_model(default_model);
+    }
+    if (peak_bytes == 0) {
+        error(1, 0, "Peak live set must be positive.");
+    }
+    outfp = out_path != NULL ? fopen(out_path, "w") : stdout;
+    if (outfp == NULL) {
+        error(1, 0, "Could not open output file \"%s\".", out_path);
+    }
+
+    gen_t g = {.rng = 0x9E3779B97F4A7C15UL * (seed + 1), .capacity = 1024, .chain_id = -1};
+    g.blocks = malloc(g.capacity * sizeof(block_t));
+    g.free_ids = malloc(g.capacity * sizeof(int));
+    g.live = malloc(g.capacity * sizeof(int));
+    if (g.blocks == NULL || g.free_ids == NULL || g.live == NULL) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+
+    for (uint64_t req = 0; req < num_requests; req++) {
+        if (g.chain_id >= 0 && random_unit(&g) < 0.5) {
+            do_realloc(&g, growth);
+        } else if (g.num_live == 0 || (g.live_bytes < peak_bytes
+                   && random_unit(&g) < 1 - 0.5 * g.live_bytes / peak_bytes)) {
+            do_alloc(&g, req, &dist, chain_prob, chain_length);
+        } else {
+            do_free(&g, lifetime);
+        }
+    }
+    while (g.num_live > 0) {
+        do_free(&g, FIFO);
+    }
+
+    fwrite(outbuf, 1, outlen, outfp);
+    if (outfp != stdout) {
+        fclose(outfp);
+    }
+    free(g.blocks);
+    free(g.free_ids);
+    free(g.live);
+    free(dist.hist_sizes);
+    free(dist.hist_cumulative);
+    return 0;
+}
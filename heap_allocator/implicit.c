@@ -2,17 +2,92 @@
  * Author: Tiantian Fang
  *
  * This file contains my implementation of the implicit allocator.
+ * Each block has just a 4-byte header holding the block size, which
+ * counts the header and is a multiple of ALIGNMENT, with bit 0 set if
+ * the block is allocated, so the heap suits tiny segments. Headers sit 4
+ * bytes before an aligned address, so every payload is 4 bytes short of
+ * a multiple of ALIGNMENT and the smallest block takes 8 bytes. Bit 1 of
+ * a header is set if the block right before it is free. The 32-bit
+ * sizes limit the heap to MAX_HEAP_SIZE bytes. myrealloc resizes in place
+ * whenever the block and the free block to its right are big enough.
+ *
+ * The blocks themselves carry nothing else, but a summary on the side,
+ * mapped separately from the heap, splits the segment into chunks of
+ * SUMMARY_CHUNK_SIZE bytes. For each chunk it keeps the offset of the
+ * first header in it, so a walk can start at any chunk, and for each of
+ * SUMMARY_CLASSES size classes a bitmap with a bit per chunk that may
+ * hold a free block of that class or bigger, with a second level marking
+ * the nonzero words of the first. firstfit scans the bitmap of the
+ * request's class a word at a time and only walks the chunks it flags,
+ * instead of every header from the start of the heap. Bits are set when
+ * a block becomes free and cleared when a walk through the chunk finds
+ * nothing that big any more.
+ *
+ * For the bits to be right, free blocks must be merged as soon as they
+ * meet, so myfree merges with both neighbours. A free block keeps a copy
+ * of its header (a footer) in its last 4 bytes, which every payload has
+ * room for, so a free left neighbour, which the prev-free bit tells
+ * about, is found in constant time. Blocks in use stay header-only.
+ *
+ * The heap starts out as whatever part of the segment is committed when
+ * myinit is called, possibly nothing, and grows at its end through
+ * extend_heap_segment whenever no free block fits a request.
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <sys/mman.h>
 #include "allocator.h"
+#include "segment.h"
 #include "debug_break.h"
 
+// the heap grows by at least this many bytes at a time
+#define HEAP_EXTEND_MIN (64 * 1024)
+
+#define PAGE_SIZE 4096
+// free blocks with at least this payload size get their pages released
+#define TRIM_MIN_SIZE (64 * 1024)
+
+#define ALLOC_BIT 1
+#define PREV_FREE_BIT 2
+#define FLAG_BITS (ALLOC_BIT | PREV_FREE_BIT)
+
+typedef uint32_t header_t;
+#define HEADER_SIZE sizeof(header_t)
+// a free block's payload holds at least its footer
+#define MIN_PL_SIZE HEADER_SIZE
+
+// largest heap segment whose block sizes fit in 32 bits
+#define MAX_HEAP_SIZE ((size_t)1 << 32)
+
+// the summary covers the segment in chunks of this many bytes, which
+// must be at most 64 KiB so offsets into a chunk fit in 16 bits
+#define SUMMARY_CHUNK_SIZE 1024
+#define MAX_CHUNKS (MAX_HEAP_SIZE / SUMMARY_CHUNK_SIZE)
+// class 0 holds every free block and class k > 0 those with payloads of
+// at least 8 << 2k bytes (32, 128, 512, ... 128K)
+#define SUMMARY_CLASSES 8
+#define WORD_BITS 64
+#define CHUNK_WORDS (MAX_CHUNKS / WORD_BITS)
+#define SUMMARY_BYTES (MAX_CHUNKS * sizeof(uint16_t) \
+                       + SUMMARY_CLASSES * (CHUNK_WORDS + CHUNK_WORDS / WORD_BITS) * sizeof(uint64_t))
+
+static char *heap_base;     // start of the heap segment, where chunk 0 starts
 static void *first_hd;
 static size_t total_size; 
+// prev-free bit of the end of the heap, as if it were a block header
+static bool end_prev_free;
+
+// the summary, in one mapping that myinit clears
+static void *summary;
+// offset of the first header in each chunk, 0 if no header starts in it
+static uint16_t *first_offsets;
+// a bit per chunk that may hold a free block of the class or bigger
+static uint64_t *chunk_bits[SUMMARY_CLASSES];
+// a bit per nonzero word of chunk_bits
+static uint64_t *word_bits[SUMMARY_CLASSES];
 
 /* Function: roundup (from bump.c)
  *
@@ -40,7 +115,7 @@ size_t roundup(size_t sz, size_t mult) {
  * This function returns a pointer to the header of given payload.
  */
 void *hdptr_of(void *plptr) {
-    return (char *)plptr - ALIGNMENT;
+    return (char *)plptr - HEADER_SIZE;
 }
 /* Function: plptr_of
  *
@@ -53,7 +128,7 @@ void *hdptr_of(void *plptr) {
  * This function returns a pointer to the payload of given header.
  */
 void *plptr_of(void *hdptr) {
-    return (char *)hdptr + ALIGNMENT;
+    return (char *)hdptr + HEADER_SIZE;
 }
 
 /* Function: isfree
@@ -67,7 +142,31 @@ void *plptr_of(void *hdptr) {
  * This function returns whether the given block is free.
  */
 bool isfree(void *hdptr){
-    return ((*(size_t *)hdptr) & 1) == 0;
+    return ((*(header_t *)hdptr) & ALLOC_BIT) == 0;
+}
+
+/* Function: isprevfree
+ *
+ * Parameters:
+ * hdptr - pointer to the header of a block
+ *
+ * Returns: 
+ * whether the block right before it in the heap is free
+ */
+bool isprevfree(void *hdptr) {
+    return ((*(header_t *)hdptr) & PREV_FREE_BIT) != 0;
+}
+
+/* Function: in_heap
+ *
+ * Parameters:
+ * hdptr - pointer to a header
+ *
+ * Returns: 
+ * whether the header lies before the end of the heap
+ */
+bool in_heap(void *hdptr) {
+    return (char *)hdptr < (char *)first_hd + total_size;
 }
 
 /* Function: get_pl_size
@@ -81,12 +180,7 @@ bool isfree(void *hdptr){
  * This function returns the block's payload size.
  */
 size_t get_pl_size(void *hdptr) {
-    if (isfree(hdptr)) {
-        return *(size_t *)hdptr;
-    }
-    else {       
-        return *(size_t *)hdptr - 1;
-    }
+    return (*(header_t *)hdptr & ~(header_t)FLAG_BITS) - HEADER_SIZE;
 }
 
 /* Function: get_next_hdptr
@@ -100,26 +194,266 @@ size_t get_pl_size(void *hdptr) {
  * This function returns a pointer to the next header in the heap.
  */
 void *get_next_hdptr(void *cur_hdptr) {
-    return (char *)cur_hdptr + ALIGNMENT + get_pl_size(cur_hdptr);
+    return (char *)cur_hdptr + HEADER_SIZE + get_pl_size(cur_hdptr);
+}
+
+/* Function: set_prev_free
+ *
+ * Parameters:
+ * hdptr - pointer to the header of a block, or to the end of the heap
+ * prev_free - whether the left neighbour of the block is free
+ *
+ * This function updates the prev-free bit of a block.
+ */
+void set_prev_free(void *hdptr, bool prev_free) {
+    if (!in_heap(hdptr)) {
+        end_prev_free = prev_free;
+        return;
+    }
+    if (prev_free) {
+        *(header_t *)hdptr |= PREV_FREE_BIT;
+    }
+    else {
+        *(header_t *)hdptr &= ~(header_t)PREV_FREE_BIT;
+    }
+}
+
+/* Function: chunk_of
+ *
+ * Parameters:
+ * ptr - an address in the heap segment
+ *
+ * Returns: 
+ * the index of the summary chunk it lies in
+ */
+size_t chunk_of(void *ptr) {
+    return ((char *)ptr - heap_base) / SUMMARY_CHUNK_SIZE;
+}
+
+/* Function: chunk_start
+ *
+ * Parameters:
+ * chunk - index of a summary chunk
+ *
+ * Returns: 
+ * the address the chunk starts at
+ */
+char *chunk_start(size_t chunk) {
+    return heap_base + chunk * SUMMARY_CHUNK_SIZE;
+}
+
+/* Function: summary_class
+ *
+ * Parameters:
+ * pl_size - payload size of a free block
+ *
+ * Returns: 
+ * the biggest summary class whose blocks are at most that big
+ */
+int summary_class(size_t pl_size) {
+    if (pl_size < 32) {
+        return 0;
+    }
+    int class = (63 - __builtin_clzl(pl_size / 8)) / 2;
+    return class < SUMMARY_CLASSES ? class : SUMMARY_CLASSES - 1;
+}
+
+/* Function: note_header
+ *
+ * Parameters:
+ * hdptr - pointer to a new header
+ *
+ * This function makes the new header the first one of its chunk if it
+ * comes before the one the summary has.
+ */
+void note_header(void *hdptr) {
+    size_t chunk = chunk_of(hdptr);
+    uint16_t offset = (char *)hdptr - chunk_start(chunk);
+    if (first_offsets[chunk] == 0 || first_offsets[chunk] > offset) {
+        first_offsets[chunk] = offset;
+    }
+}
+
+/* Function: forget_header
+ *
+ * Parameters:
+ * hdptr - pointer to a header that was merged into the block before it
+ * next_hd - header right after the merged block
+ *
+ * This function drops the header from the summary. If it was the first
+ * of its chunk, the next one in the chunk, if any, is next_hd.
+ */
+void forget_header(void *hdptr, void *next_hd) {
+    size_t chunk = chunk_of(hdptr);
+    if (chunk_start(chunk) + first_offsets[chunk] != (char *)hdptr) {
+        return;
+    }
+    if (in_heap(next_hd) && chunk_of(next_hd) == chunk) {
+        first_offsets[chunk] = (char *)next_hd - chunk_start(chunk);
+    }
+    else {
+        first_offsets[chunk] = 0;
+    }
+}
+
+/* Function: mark_free_bl
+ *
+ * Parameters:
+ * hdptr - pointer to the header of a free block
+ *
+ * This function sets the bits of the block's chunk for its size class
+ * and every smaller one.
+ */
+void mark_free_bl(void *hdptr) {
+    size_t chunk = chunk_of(hdptr);
+    size_t word = chunk / WORD_BITS;
+    for (int class = summary_class(get_pl_size(hdptr)); class >= 0; class--) {
+        chunk_bits[class][word] |= (uint64_t)1 << (chunk % WORD_BITS);
+        word_bits[class][word / WORD_BITS] |= (uint64_t)1 << (word % WORD_BITS);
+    }
+}
+
+/* Function: unmark_chunk
+ *
+ * Parameters:
+ * chunk - index of a summary chunk
+ * top_class - biggest class of the free blocks left in it, -1 for none
+ *
+ * This function clears the chunk's bits for the classes above top_class,
+ * after a walk through the chunk found nothing bigger.
+ */
+void unmark_chunk(size_t chunk, int top_class) {
+    size_t word = chunk / WORD_BITS;
+    for (int class = top_class + 1; class < SUMMARY_CLASSES; class++) {
+        chunk_bits[class][word] &= ~((uint64_t)1 << (chunk % WORD_BITS));
+        if (chunk_bits[class][word] == 0) {
+            word_bits[class][word / WORD_BITS] &= ~((uint64_t)1 << (word % WORD_BITS));
+        }
+    }
+}
+
+/* Function: next_marked_chunk
+ *
+ * Parameters:
+ * class - summary class
+ * chunk - index of the chunk to start at
+ * end_chunk - index of the chunk to stop before
+ *
+ * Returns: 
+ * the first chunk from the given one on that may hold a free block of
+ * the class, or end_chunk if there is none
+ *
+ * This function skips 64 chunks at a time through zero words of the
+ * class's bitmap and 4096 at a time through zero words of its second
+ * level.
+ */
+size_t next_marked_chunk(int class, size_t chunk, size_t end_chunk) {
+    size_t end_word = (end_chunk + WORD_BITS - 1) / WORD_BITS;
+    size_t word = chunk / WORD_BITS;
+    uint64_t bits = chunk_bits[class][word] & (~(uint64_t)0 << (chunk % WORD_BITS));
+    while (bits == 0) {
+        word++;
+        size_t top = word / WORD_BITS;
+        uint64_t top_bits = word_bits[class][top] & (~(uint64_t)0 << (word % WORD_BITS));
+        while (top_bits == 0) {
+            top++;
+            if (top * WORD_BITS >= end_word) {
+                return end_chunk;
+            }
+            top_bits = word_bits[class][top];
+        }
+        word = top * WORD_BITS + __builtin_ctzl(top_bits);
+        if (word >= end_word) {
+            return end_chunk;
+        }
+        bits = chunk_bits[class][word];
+    }
+    chunk = word * WORD_BITS + __builtin_ctzl(bits);
+    return chunk < end_chunk ? chunk : end_chunk;
+}
+
+/* Function: get_prev_hdptr
+ *
+ * Parameters:
+ * hdptr - pointer to a header, or to the end of the heap
+ *
+ * Returns: 
+ * pointer to the header of the free block right before it
+ *
+ * This function reads the size of the block before it from that block's
+ * footer, so it only works if its prev-free bit is set.
+ */
+void *get_prev_hdptr(void *hdptr) {
+    return (char *)hdptr - *((header_t *)hdptr - 1);
 }
 
-/* Function: make_block
+/* Function: coalesce_next
  *
  * Parameters:
- * hdptr - pointer to the header of the block to be made
+ * hdptr - pointer to the header of a block
+ *
+ * Returns: 
+ * the block's new payload size
+ *
+ * This function merges the free block right after the given block, if
+ * there is one, into it, keeping its flags, and updates the prev-free bit
+ * of the block after that.
+ */
+size_t coalesce_next(void *hdptr) {
+    size_t pl_size = get_pl_size(hdptr);
+    void *next_hd = get_next_hdptr(hdptr);
+    if (in_heap(next_hd) && isfree(next_hd)) {
+        pl_size += HEADER_SIZE + get_pl_size(next_hd);
+        *(header_t *)hdptr = (HEADER_SIZE + pl_size) | (*(header_t *)hdptr & FLAG_BITS);
+        forget_header(next_hd, get_next_hdptr(hdptr));
+        set_prev_free(get_next_hdptr(hdptr), isfree(hdptr));
+    }
+    return pl_size;
+}
+
+/* Function: make_free_bl
+ *
+ * Parameters:
+ * hdptr - pointer to the header of the free block to be made
  * pl_size - payload size
- * free - if the block should be free
+ *
+ * This function makes a free block with a footer, adds it to the summary
+ * and sets its right neighbour's prev-free bit. The left neighbour of a
+ * free block is never free, so the header has no flags.
+ */
+void make_free_bl(void *hdptr, size_t pl_size) {
+    *(header_t *)hdptr = HEADER_SIZE + pl_size;
+    *((header_t *)get_next_hdptr(hdptr) - 1) = HEADER_SIZE + pl_size;
+    note_header(hdptr);
+    mark_free_bl(hdptr);
+    set_prev_free(get_next_hdptr(hdptr), true);
+}
+
+/* Function: place_block
+ *
+ * Parameters:
+ * hdptr - pointer to the header of the block, whose right neighbour is
+ *         in use
+ * pl_size - the block's payload size
+ * needed_size - payload size to keep
  *
  * Returns: 
  * pointer to the payload
  *
- * This function makes a block and returns a pointer to its payload. 
+ * This function marks the block as allocated with the needed size and
+ * splits the rest off as a free block if there is room for one.
  */
-void *make_block(void *hdptr, size_t pl_size, bool free) {
-    if (!free) {
-        pl_size |= 1;
+void *place_block(void *hdptr, size_t pl_size, size_t needed_size) {
+    header_t prev_free_bit = *(header_t *)hdptr & PREV_FREE_BIT;
+    //check if we have room for another free block
+    if (pl_size >= needed_size + HEADER_SIZE + MIN_PL_SIZE) {
+        make_free_bl((char *)hdptr + HEADER_SIZE + needed_size, pl_size - needed_size - HEADER_SIZE);
+        pl_size = needed_size;
     }
-    *(size_t *)hdptr = pl_size;
+    else {
+        set_prev_free((char *)hdptr + HEADER_SIZE + pl_size, false);
+    }
+    *(header_t *)hdptr = (HEADER_SIZE + pl_size) | prev_free_bit | ALLOC_BIT;
     return plptr_of(hdptr);
 }
 
@@ -137,19 +471,85 @@ void *make_block(void *hdptr, size_t pl_size, bool free) {
  * successful, or false otherwise. The myinit function can be 
  * called to reset the heap to an empty state. When running 
  * against a set of of test scripts, the test harness calls 
- * myinit before starting each new script.
+ * myinit before starting each new script. The first header goes 4 bytes
+ * into the heap, and the last 4 bytes are left over. The summary is
+ * mapped the first time and cleared after that.
  */
 bool myinit(void *heap_start, size_t heap_size) {
-    //The heap needs to have a size of at least 2 * ALIGNMENT
-    if (heap_size < 2 * ALIGNMENT) {
+    //The heap needs to be empty or have room for one block
+    if ((heap_size != 0 && heap_size < 2 * ALIGNMENT) || heap_size > MAX_HEAP_SIZE) {
         return false;
     }
-    else {
-        first_hd = heap_start;
-        total_size = heap_size;
-        make_block(heap_start, heap_size - ALIGNMENT, true);
-        return true;
+    if (summary == NULL) {
+        summary = mmap(NULL, SUMMARY_BYTES, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (summary == MAP_FAILED) {
+            summary = NULL;
+            return false;
+        }
+        uint64_t *bits = (uint64_t *)((uint16_t *)summary + MAX_CHUNKS);
+        for (int class = 0; class < SUMMARY_CLASSES; class++) {
+            chunk_bits[class] = bits;
+            word_bits[class] = bits + CHUNK_WORDS;
+            bits += CHUNK_WORDS + CHUNK_WORDS / WORD_BITS;
+        }
+        first_offsets = summary;
+    }
+    else if (madvise(summary, SUMMARY_BYTES, MADV_DONTNEED) == -1) {
+        return false;
+    }
+
+    heap_base = heap_start;
+    first_hd = heap_base + HEADER_SIZE;
+    total_size = heap_size > 0 ? (heap_size - ALIGNMENT) & ~(size_t)(ALIGNMENT - 1) : 0;
+    end_prev_free = false;
+    if (total_size > 0) {
+        make_free_bl(first_hd, total_size - HEADER_SIZE);
+    }
+    return true;
+}
+
+/* Function: extend_heap
+ *
+ * Parameters:
+ * needed_size - payload size the heap must be able to hold at its end
+ *
+ * Returns: 
+ * whether the heap could grow
+ *
+ * This function commits more of the heap segment right after the end of
+ * the heap, at least HEAP_EXTEND_MIN bytes, and turns it into a free
+ * block of at least needed_size bytes. If the last block of the heap is
+ * free, which the prev-free bit of the end tells, the new memory is added
+ * to it so less has to be committed.
+ * The segment grows by whole pages, which always covers the 4 bytes left
+ * over at each end of the heap as well.
+ */
+bool extend_heap(size_t needed_size) {
+    void *end = (char *)first_hd + total_size;
+    void *last_hd = end;
+    size_t last_size = 0;
+    if (end_prev_free) {
+        last_hd = get_prev_hdptr(end);
+        last_size = HEADER_SIZE + get_pl_size(last_hd);
     }
+
+    size_t grow = ALIGNMENT + needed_size - last_size;
+    if (grow < HEAP_EXTEND_MIN) {
+        grow = HEAP_EXTEND_MIN;
+    }
+    char *segment_end = total_size > 0 ? (char *)end + HEADER_SIZE : heap_base;
+    if (segment_end + grow - heap_base > MAX_HEAP_SIZE) {
+        return false;
+    }
+    //the new memory is only usable if it continues this heap
+    if (extend_heap_segment(grow) != segment_end) {
+        return false;
+    }
+    segment_end = (char *)heap_segment_start() + heap_segment_size();
+    total_size = segment_end - HEADER_SIZE - (char *)first_hd;
+    make_free_bl(last_hd, (char *)first_hd + total_size - (char *)last_hd - HEADER_SIZE);
+    return true;
 }
 
 /* Function: firstfit
@@ -160,28 +560,36 @@ bool myinit(void *heap_start, size_t heap_size) {
  * Returns: 
  * pointer to the payload of the block that the needed size can fit in
  *
- * This function finds a free block that can accommodate the needed size 
- * using first fit and then returns a pointer to its payload.
+ * This function finds the first free block that can accommodate the
+ * needed size and then returns a pointer to its payload. It only walks
+ * the chunks that the summary flags for the needed size's class, and a
+ * chunk walked through without a fit has its bits cut down to the
+ * biggest free block it still holds.
  */
 void *firstfit(size_t needed_size) {
-    size_t cur_pl_size;    
-    void *cur_hd = first_hd;
-    
-    while ((char *)cur_hd < (char *)first_hd + total_size) {
-        cur_pl_size = get_pl_size(cur_hd);
-   
-        if (isfree(cur_hd) && (cur_pl_size >= needed_size)) {
-            //check if we have room for another free block
-            if (cur_pl_size >= needed_size + 2 * ALIGNMENT) {
-                make_block((char *)cur_hd + ALIGNMENT + needed_size,
-                           cur_pl_size - needed_size - ALIGNMENT, true);
-                return make_block(cur_hd, needed_size, false);
-            }
-            else {
-                return make_block(cur_hd, cur_pl_size, false);
+    int class = summary_class(needed_size);
+    size_t end_chunk = total_size > 0 ? chunk_of((char *)first_hd + total_size - 1) + 1 : 0;
+    size_t chunk = next_marked_chunk(class, 0, end_chunk);
+
+    while (chunk < end_chunk) {
+        char *chunk_end = chunk_start(chunk + 1);
+        //a chunk whose headers were all merged away is still marked
+        void *cur_hd = first_offsets[chunk] != 0 ? chunk_start(chunk) + first_offsets[chunk] : chunk_end;
+        int top_class = -1;
+        while ((char *)cur_hd < chunk_end && in_heap(cur_hd)) {
+            if (isfree(cur_hd)) {
+                size_t cur_pl_size = get_pl_size(cur_hd);
+                if (cur_pl_size >= needed_size) {
+                    return place_block(cur_hd, cur_pl_size, needed_size);
+                }
+                if (summary_class(cur_pl_size) > top_class) {
+                    top_class = summary_class(cur_pl_size);
+                }
             }
+            cur_hd = get_next_hdptr(cur_hd);
         }
-        cur_hd = get_next_hdptr(cur_hd);
+        unmark_chunk(chunk, top_class);
+        chunk = next_marked_chunk(class, chunk + 1, end_chunk);
     }
     return NULL;
 }
@@ -195,14 +603,19 @@ void *firstfit(size_t needed_size) {
  * pointer to the payload of the block that the requested size can fit in
  *
  * This function alllocates the requested size 
- * and then returns a pointer to its payload.
+ * and then returns a pointer to its payload. If no free block fits,
+ * the heap is extended first.
  */
 void *mymalloc(size_t requested_size) {
     if (requested_size == 0 || requested_size > MAX_REQUEST_SIZE) {
         return NULL;
     }
-    size_t needed_size = roundup(requested_size, ALIGNMENT);
-    return firstfit(needed_size);
+    size_t needed_size = roundup(requested_size + HEADER_SIZE, ALIGNMENT) - HEADER_SIZE;
+    void *ptr = firstfit(needed_size);
+    if (ptr == NULL && extend_heap(needed_size)) {
+        ptr = firstfit(needed_size);
+    }
+    return ptr;
 }
 
 /* Function: myfree
@@ -210,12 +623,27 @@ void *mymalloc(size_t requested_size) {
  * Parameters:
  * ptr - pointer to the payload to be freed
  *
- * This function frees a previously allocated block.
+ * This function frees a previously allocated block and merges it with
+ * its neighbours if they are free.
  */
 void myfree(void *ptr) {
     if (ptr != NULL) {
         void *hd = hdptr_of(ptr);
-        *(size_t *)hd -= 1;
+        if (!isfree(hd)) {
+            size_t pl_size = get_pl_size(hd);
+            void *next_hd = get_next_hdptr(hd);
+            if (in_heap(next_hd) && isfree(next_hd)) {
+                pl_size += HEADER_SIZE + get_pl_size(next_hd);
+                forget_header(next_hd, get_next_hdptr(next_hd));
+            }
+            if (isprevfree(hd)) {
+                void *prev_hd = get_prev_hdptr(hd);
+                pl_size += HEADER_SIZE + get_pl_size(prev_hd);
+                forget_header(hd, (char *)plptr_of(prev_hd) + pl_size);
+                hd = prev_hd;
+            }
+            make_free_bl(hd, pl_size);
+        }
     }
 }
 
@@ -225,7 +653,10 @@ void myfree(void *ptr) {
  * old_ptr - pointer to the payload to be reallocated
  * new_size - the new size requested
  *
- * This function reallocates a previously allocated block.
+ * This function reallocates a previously allocated block. The block is
+ * first merged with the free block to its right; if that is big enough
+ * it is resized in place and the rest is split off, otherwise the payload
+ * moves to a new block.
  */
 void *myrealloc(void *old_ptr, size_t new_size) {
     if  (old_ptr == NULL) {
@@ -235,20 +666,194 @@ void *myrealloc(void *old_ptr, size_t new_size) {
         myfree(old_ptr);
         return NULL;
     }
- 
+    if (new_size > MAX_REQUEST_SIZE) {
+        return NULL;
+    }
+
+    size_t needed_size = roundup(new_size + HEADER_SIZE, ALIGNMENT) - HEADER_SIZE;
+    void *hd = hdptr_of(old_ptr);
+    size_t old_size = get_pl_size(hd);
+    size_t pl_size = coalesce_next(hd);
+    if (needed_size <= pl_size) {
+        return place_block(hd, pl_size, needed_size);
+    }
     void *new_ptr = mymalloc(new_size);
     if (new_ptr != NULL) {
-        memcpy(new_ptr, old_ptr, new_size);
+        memcpy(new_ptr, old_ptr, old_size);
         myfree(old_ptr);
     }
     return new_ptr;
 }
 
+/* Function: mycalloc
+ *
+ * Parameters:
+ * nmemb - number of elements
+ * size - size of each element
+ *
+ * Returns: 
+ * pointer to the zeroed payload, or NULL
+ *
+ * This function allocates an array and clears it.
+ */
+void *mycalloc(size_t nmemb, size_t size) {
+    if (size != 0 && nmemb > MAX_REQUEST_SIZE / size) {
+        return NULL;
+    }
+    void *ptr = mymalloc(nmemb * size);
+    if (ptr != NULL) {
+        memset(ptr, 0, nmemb * size);
+    }
+    return ptr;
+}
+
+/* Function: mymemalign
+ *
+ * Parameters:
+ * alignment - required alignment of the payload, a power of two
+ * size - requested size
+ *
+ * Returns: 
+ * pointer to an aligned payload, or NULL
+ *
+ * This function allocates a block big enough to slide the payload up to
+ * an aligned address and still leave a block in front of it. The leading
+ * slack becomes a free block, and the tail that firstfit may have split
+ * off is merged back before the block is split again for its real size.
+ * The block came from a free one, so its left neighbour is in use and the
+ * slack has nothing to merge with.
+ */
+void *mymemalign(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0 || alignment > MAX_REQUEST_SIZE) {
+        return NULL;
+    }
+    if (alignment <= ALIGNMENT) {
+        return mymalloc(size);
+    }
+    if (size == 0 || size > MAX_REQUEST_SIZE) {
+        return NULL;
+    }
+    size_t needed_size = roundup(size + HEADER_SIZE, ALIGNMENT) - HEADER_SIZE;
+    size_t padded_size = needed_size + alignment + HEADER_SIZE + MIN_PL_SIZE;
+    void *ptr = firstfit(padded_size);
+    if (ptr == NULL && extend_heap(padded_size)) {
+        ptr = firstfit(padded_size);
+    }
+    if (ptr == NULL) {
+        return NULL;
+    }
+
+    void *hd = hdptr_of(ptr);
+    size_t pl_size = get_pl_size(hd);
+    if ((uintptr_t)ptr % alignment != 0) {
+        char *aligned = (char *)(((uintptr_t)ptr + HEADER_SIZE + MIN_PL_SIZE + alignment - 1)
+                                 & ~(uintptr_t)(alignment - 1));
+        size_t lead_size = aligned - (char *)ptr - HEADER_SIZE;
+        pl_size -= lead_size + HEADER_SIZE;
+        hd = hdptr_of(aligned);
+        *(header_t *)hd = (HEADER_SIZE + pl_size) | ALLOC_BIT;
+        note_header(hd);
+        make_free_bl(hdptr_of(ptr), lead_size);
+    }
+    pl_size = coalesce_next(hd);
+    return place_block(hd, pl_size, needed_size);
+}
+
+/* Function: myusable_size
+ *
+ * Parameters:
+ * ptr - pointer to an allocated payload
+ *
+ * Returns: 
+ * how many bytes of the payload can be used
+ *
+ * This function returns the whole payload size, including the bytes that
+ * rounding added to the requested size.
+ */
+size_t myusable_size(void *ptr) {
+    if (ptr == NULL) {
+        return 0;
+    }
+    return get_pl_size(hdptr_of(ptr));
+}
+
+/* Function: myheap_stats
+ *
+ * Parameters:
+ * stats - where to store the snapshot
+ *
+ * This function walks the heap to fill in the snapshot.
+ */
+void myheap_stats(struct heap_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->heap_bytes = total_size;
+    for (void *hd = first_hd; in_heap(hd); hd = get_next_hdptr(hd)) {
+        size_t pl_size = get_pl_size(hd);
+        if (!isfree(hd)) {
+            stats->live_bytes += pl_size;
+            stats->live_blocks++;
+            continue;
+        }
+        int bucket = 63 - __builtin_clzl(pl_size);
+        stats->free_histogram[bucket < HEAP_STATS_BUCKETS ? bucket : HEAP_STATS_BUCKETS - 1]++;
+        stats->free_bytes += pl_size;
+        stats->free_blocks++;
+        if (pl_size > stats->largest_free) {
+            stats->largest_free = pl_size;
+        }
+    }
+    if (stats->free_bytes > 0) {
+        stats->fragmentation = 1.0 - (double)stats->largest_free / stats->free_bytes;
+    }
+}
+
+/* Function: mytrim
+ *
+ * Returns: 
+ * number of bytes given back to the OS
+ *
+ * This function walks the heap and releases the whole pages inside every
+ * free block of at least TRIM_MIN_SIZE bytes with madvise. The pages read
+ * back as zeros the next time they are used.
+ */
+size_t mytrim() {
+    size_t released = 0;
+    for (void *hd = first_hd; in_heap(hd); hd = get_next_hdptr(hd)) {
+        if (isfree(hd) && get_pl_size(hd) >= TRIM_MIN_SIZE) {
+            uintptr_t start = ((uintptr_t)plptr_of(hd) + PAGE_SIZE - 1) & ~(uintptr_t)(PAGE_SIZE - 1);
+            uintptr_t end = (uintptr_t)get_next_hdptr(hd) & ~(uintptr_t)(PAGE_SIZE - 1);
+            if (end > start && madvise((void *)start, end - start, MADV_DONTNEED) == 0) {
+                released += end - start;
+            }
+        }
+    }
+    return released;
+}
+
+/* Function: is_marked
+ *
+ * Parameters:
+ * class - summary class
+ * chunk - index of a summary chunk
+ *
+ * Returns: 
+ * whether the chunk's bit is set for the class at both levels
+ */
+bool is_marked(int class, size_t chunk) {
+    size_t word = chunk / WORD_BITS;
+    return (chunk_bits[class][word] >> (chunk % WORD_BITS) & 1)
+        && (word_bits[class][word / WORD_BITS] >> (word % WORD_BITS) & 1);
+}
+
 /* Function: validate_heap
  *
  * Return true if all is ok, or false otherwise.
  * This function is called periodically by the test
  * harness to check the state of the heap allocator.
+ * Besides the block sizes, it checks the prev-free bits and footers, that
+ * no two free blocks are next to each other, that the summary has the first header
+ * of every chunk and that every free block's chunk is marked for its
+ * class.
  */
 bool validate_heap() {
     void *hd = first_hd;
@@ -256,14 +861,32 @@ bool validate_heap() {
     size_t pl_free = 0;
     size_t nused = 0;
     size_t nfree = 0;
+    bool prev_free = false;
+    size_t next_chunk = 0;    // chunks before this one have been checked
     
-    while ((char *)hd < (char *)first_hd + total_size) {
-        size_t cur_pl_size = get_pl_size(hd);
-        if (cur_pl_size < ALIGNMENT) {
+    while (in_heap(hd)) {
+        if ((*(header_t *)hd & ~(header_t)FLAG_BITS) < HEADER_SIZE + MIN_PL_SIZE) {
             printf("Block at address %p has incorrect payload.\n", hd);
             breakpoint();
             return false;
         }
+        if (isprevfree(hd) != prev_free) {
+            printf("Block at address %p has a wrong prev-free bit.\n", hd);
+            breakpoint();
+            return false;
+        }
+        //chunks before this header's own have no header at all
+        size_t chunk = chunk_of(hd);
+        for (; next_chunk <= chunk; next_chunk++) {
+            uint16_t offset = next_chunk == chunk ? (char *)hd - chunk_start(chunk) : 0;
+            if (first_offsets[next_chunk] != offset) {
+                printf("The summary has the wrong first header for the chunk at %p.\n",
+                       chunk_start(next_chunk));
+                breakpoint();
+                return false;
+            }
+        }
+        size_t cur_pl_size = get_pl_size(hd);
         if (!isfree(hd)) {
             pl_used += cur_pl_size;
             nused ++;
@@ -271,16 +894,40 @@ bool validate_heap() {
         else {
             pl_free += cur_pl_size;
             nfree ++;
+            if (prev_free) {
+                printf("Free block at address %p was not merged with the block before it.\n", hd);
+                breakpoint();
+                return false;
+            }
+            if (!in_heap((char *)get_next_hdptr(hd) - 1)
+                || *((header_t *)get_next_hdptr(hd) - 1) != *(header_t *)hd) {
+                printf("Free block at address %p has a footer that doesn't match its header.\n", hd);
+                breakpoint();
+                return false;
+            }
+            for (int class = summary_class(cur_pl_size); class >= 0; class--) {
+                if (!is_marked(class, chunk)) {
+                    printf("Free block at address %p is missing from the summary.\n", hd);
+                    breakpoint();
+                    return false;
+                }
+            }
         }
+        prev_free = isfree(hd);
         hd = get_next_hdptr(hd);   
     }
+    if (end_prev_free != prev_free) {
+        printf("The end of the heap has a wrong prev-free bit.\n");
+        breakpoint();
+        return false;
+    }
     
-    if (pl_used + nused * ALIGNMENT > total_size) {
+    if (pl_used + nused * HEADER_SIZE > total_size) {
         printf("Used more heap than available.\n");
         breakpoint();
         return false;
     }    
-    if (pl_used + pl_free + (nused + nfree) * ALIGNMENT != total_size) {
+    if (pl_used + pl_free + (nused + nfree) * HEADER_SIZE != total_size) {
         printf("Sum of all block sizes doesn't match total size of the heap.\n");
         breakpoint();
         return false;
@@ -297,7 +944,8 @@ void dump_heap() {
            first_hd, (char *)first_hd + total_size);
     void *cur = first_hd;
     while ((char *)cur < (char *)first_hd + total_size) {
-        printf("\n%p: ", cur);
-        printf("%lu ", *(size_t *)cur);
+        printf("\n%p: %lu %s", cur, get_pl_size(cur), isfree(cur) ? "free" : "used");
+        cur = get_next_hdptr(cur);
     }
+    printf("\n");
 }
@@ -0,0 +1,112 @@
+/* File: pack_script.c
+ * -------------------
+ * Converts a text script in the a/r/f format read by test_harness into
+ * the packed binary trace format described in trace.h. test_harness maps
+ * a trace into memory instead of parsing it line by line, so converting
+ * a long script once makes every later run of it start right away. The
+ * script is read as a stream, so it can be piped in from gen_script.
+ *
+ * Usage: pack_script script_file|- trace_file
+ */
+
+#include <error.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "allocator.h"
+#include "trace.h"
+
+const int MAX_SCRIPT_LINE_LEN = 1024;
+
+// Output buffer, flushed whenever it can't take another record
+static uint8_t outbuf[1 << 16];
+static size_t outlen;
+
+/* Function: parse_number
+ * ----------------------
+ * Skips blanks and parses a decimal number at *pstr, advancing *pstr past
+ * it. Returns false if there is no number there.
+ */
+static bool parse_number(const char **pstr, uint64_t *pvalue) {
+    const char *p = *pstr;
+    while (*p == ' ' || *p == '\t') {
+        p++;
+    }
+    if (*p < '0' || *p > '9') {
+        return false;
+    }
+    uint64_t value = 0;
+    while (*p >= '0' && *p <= '9' && value <= UINT64_MAX / 10 - 9) {
+        value = value * 10 + (*p++ - '0');
+    }
+    *pstr = p;
+    *pvalue = value;
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        error(1, 0, "Usage: %s script_file|- trace_file", argv[0]);
+    }
+    FILE *in = strcmp(argv[1], "-") == 0 ? stdin : fopen(argv[1], "r");
+    if (in == NULL) {
+        error(1, 0, "Could not open script file \"%s\".", argv[1]);
+    }
+    FILE *out = fopen(argv[2], "w");
+    if (out == NULL) {
+        error(1, 0, "Could not open trace file \"%s\".", argv[2]);
+    }
+
+    // the header is written again at the end, once the counts are known
+    trace_header_t header = {0};
+    memcpy(header.magic, TRACE_MAGIC, TRACE_MAGIC_LEN);
+    fwrite(&header, sizeof(header), 1, out);
+
+    char buffer[MAX_SCRIPT_LINE_LEN];
+    int lineno = 0;
+    int prev_id = 0;
+    uint64_t maxid = 0;
+    while (fgets(buffer, sizeof(buffer), in) != NULL) {
+        lineno++;
+        const char *p = buffer;
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        // skip blank and comment lines, like the harness does
+        if (*p == '\0' || *p == '\n' || *p == '\r' || *p == '#') {
+            continue;
+        }
+
+        int op = *p == 'a' ? TRACE_ALLOC : *p == 'r' ? TRACE_REALLOC : *p == 'f' ? TRACE_FREE : 0;
+        p++;
+        uint64_t id, size = 0;
+        if (op == 0 || !parse_number(&p, &id) || id > INT_MAX
+            || (op != TRACE_FREE && (!parse_number(&p, &size) || size > MAX_REQUEST_SIZE))) {
+            error(1, 0, "Line %d of script file '%s' is malformed.", lineno, argv[1]);
+        }
+
+        if (outlen > sizeof(outbuf) - (1 + 2 * TRACE_MAX_VARINT)) {
+            fwrite(outbuf, 1, outlen, out);
+            outlen = 0;
+        }
+        outlen += trace_put_record(outbuf + outlen, op, id, prev_id, size);
+        prev_id = id;
+        header.counts[op - TRACE_ALLOC]++;
+        header.num_ops++;
+        if (id > maxid) {
+            maxid = id;
+        }
+    }
+    fwrite(outbuf, 1, outlen, out);
+
+    header.num_ids = maxid + 1;
+    if (fseek(out, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, out) != 1
+        || fclose(out) != 0) {
+        error(1, 0, "Could not write trace file \"%s\".", argv[2]);
+    }
+    if (in != stdin) {
+        fclose(in);
+    }
+    return 0;
+}
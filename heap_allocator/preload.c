@@ -0,0 +1,277 @@
+/* File: preload.c
+ * ---------------
+ * Exposes the explicit allocator as the C library's malloc family, so
+ * that it can be run under any dynamically linked program with
+ *
+ *     LD_PRELOAD=./libexplicit_preload.so program ...
+ *
+ * The heap segment is reserved and myinit is called on the first request.
+ * One mutex serializes all requests, so threaded programs work too.
+ *
+ * Programs may rely on malloc returning memory aligned for any type,
+ * 16 bytes on x86-64, while explicit.c only aligns to 8. Each request
+ * therefore asks for 8 more bytes and, if the payload isn't aligned,
+ * hands out the next aligned address, storing the distance back to the
+ * payload in the 4 bytes just before it. Those 4 bytes are the block
+ * header otherwise, whose ALLOC_BIT is always set for a block in use, and
+ * the distance is 8, so free can tell the two cases apart. Bigger alignments
+ * go to mymemalign, whose payloads are aligned already.
+ *
+ * With HEAP_TRACE=file in the environment, every request that succeeds
+ * is also recorded into file as a binary trace (see recorder.h), which
+ * test_explicit and the other test_ programs can replay. A "%p" in the
+ * name is replaced by the process id, so that programs started by the
+ * recorded one write traces of their own. The trace is finished when the
+ * program exits normally.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "allocator.h"
+#include "recorder.h"
+#include "segment.h"
+
+// exported from the shared library, which otherwise hides its symbols
+#define EXPORT __attribute__((visibility("default")))
+
+// alignment that malloc promises to its callers
+#define MALLOC_ALIGNMENT 16
+
+// bit of an explicit.c block header that is set for a block in use
+#define HEADER_ALLOC_BIT 1
+
+const long HEAP_SIZE = 1L << 32;
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool initialized;
+
+/* Function: lock_heap
+ * -------------------
+ * Takes the heap lock, setting up the heap, and the trace if one was
+ * asked for, on the very first request. Returns false, with the lock
+ * released, if the heap can't be set up.
+ */
+static bool lock_heap(void) {
+    pthread_mutex_lock(&heap_lock);
+    if (!initialized) {
+        init_heap_segment(HEAP_SIZE);
+        if (!myinit(heap_segment_start(), heap_segment_size())) {
+            pthread_mutex_unlock(&heap_lock);
+            return false;
+        }
+        initialized = true;
+        const char *trace_path = getenv("HEAP_TRACE");
+        if (trace_path != NULL && *trace_path != '\0') {
+            record_open(trace_path);
+        }
+    }
+    return true;
+}
+
+/* Functions: lock_for_fork, unlock_after_fork, unlock_in_child
+ * -------------------------------------------------------------
+ * A forked child gets a copy of the heap, which must not be in the middle
+ * of a request, so the heap lock is held across fork. The trace belongs
+ * to the parent, so the child stops recording. The handlers are
+ * registered when the library is loaded, since pthread_atfork may itself
+ * call malloc.
+ */
+static void lock_for_fork(void) {
+    pthread_mutex_lock(&heap_lock);
+}
+
+static void unlock_after_fork(void) {
+    pthread_mutex_unlock(&heap_lock);
+}
+
+static void unlock_in_child(void) {
+    record_abandon();
+    pthread_mutex_unlock(&heap_lock);
+}
+
+__attribute__((constructor)) static void register_fork_handlers(void) {
+    pthread_atfork(lock_for_fork, unlock_after_fork, unlock_in_child);
+}
+
+/* Function: finish_trace
+ * ----------------------
+ * Writes out the rest of the trace, if there is one, when the program
+ * exits. Requests made after this are no longer recorded.
+ */
+__attribute__((destructor)) static void finish_trace(void) {
+    pthread_mutex_lock(&heap_lock);
+    record_close();
+    pthread_mutex_unlock(&heap_lock);
+}
+
+/* Function: offset_of
+ * -------------------
+ * Returns how far the pointer handed out is past the payload of its block.
+ */
+static size_t offset_of(void *ptr) {
+    uint32_t word = *((uint32_t *)ptr - 1);
+    return (word & HEADER_ALLOC_BIT) ? 0 : word;
+}
+
+/* Function: align_payload
+ * -----------------------
+ * Returns the first address at or after the payload that is aligned to
+ * MALLOC_ALIGNMENT, recording its offset from the payload if there is one.
+ */
+static void *align_payload(void *payload) {
+    uintptr_t aligned = ((uintptr_t)payload + MALLOC_ALIGNMENT - 1) & ~(uintptr_t)(MALLOC_ALIGNMENT - 1);
+    if (aligned != (uintptr_t)payload) {
+        *((uint32_t *)aligned - 1) = aligned - (uintptr_t)payload;
+    }
+    return (void *)aligned;
+}
+
+/* Function: usable_size
+ * ---------------------
+ * Returns how many bytes can be used at the given pointer, which is the
+ * usable size of its block minus its offset into the payload.
+ */
+static size_t usable_size(void *ptr) {
+    size_t offset = offset_of(ptr);
+    return myusable_size((char *)ptr - offset) - offset;
+}
+
+/* Function: aligned_malloc
+ * ------------------------
+ * Allocates size bytes aligned to alignment, a power of two no smaller
+ * than MALLOC_ALIGNMENT, or returns NULL and sets errno.
+ */
+static void *aligned_malloc(size_t alignment, size_t size) {
+    if (size > MAX_REQUEST_SIZE - MALLOC_ALIGNMENT) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (!lock_heap()) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    // ask for at least one byte so that even malloc(0) returns a block
+    void *payload = alignment > MALLOC_ALIGNMENT
+        ? mymemalign(alignment, size > 0 ? size : 1)
+        : mymalloc((size > 0 ? size : 1) + MALLOC_ALIGNMENT - ALIGNMENT);
+    void *ptr = payload != NULL ? align_payload(payload) : NULL;
+    if (ptr != NULL) {
+        record_alloc(ptr, size);
+    }
+    pthread_mutex_unlock(&heap_lock);
+    if (ptr == NULL) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+EXPORT void *malloc(size_t size) {
+    return aligned_malloc(MALLOC_ALIGNMENT, size);
+}
+
+EXPORT void free(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&heap_lock);
+    record_free(ptr);
+    myfree((char *)ptr - offset_of(ptr));
+    pthread_mutex_unlock(&heap_lock);
+}
+
+EXPORT void *calloc(size_t nmemb, size_t size) {
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    // not malloc, or the compiler turns malloc and memset into a call to calloc
+    void *ptr = aligned_malloc(MALLOC_ALIGNMENT, nmemb * size);
+    if (ptr != NULL) {
+        memset(ptr, 0, nmemb * size);
+    }
+    return ptr;
+}
+
+/* Function: realloc
+ * -----------------
+ * Resizes the block with myrealloc, which keeps the bytes at the start of
+ * the payload, then moves the data if its offset from the payload has to
+ * change.
+ */
+EXPORT void *realloc(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return malloc(size);
+    }
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    if (size > MAX_REQUEST_SIZE - MALLOC_ALIGNMENT) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    // the header is read under the lock, since freeing the block before it
+    // rewrites its prev-free bit
+    pthread_mutex_lock(&heap_lock);
+    size_t offset = offset_of(ptr);
+    size_t old_size = usable_size(ptr);
+    size_t keep = old_size < size ? old_size : size;
+    char *payload = myrealloc((char *)ptr - offset, size + MALLOC_ALIGNMENT - ALIGNMENT);
+    size_t new_offset = (uintptr_t)payload % MALLOC_ALIGNMENT;
+    if (payload != NULL) {
+        record_realloc(ptr, payload + new_offset, size);
+    }
+    pthread_mutex_unlock(&heap_lock);
+    if (payload == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (new_offset != offset) {
+        memmove(payload + new_offset, payload + offset, keep);
+    }
+    return align_payload(payload);
+}
+
+EXPORT int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void *ptr = aligned_malloc(alignment > MALLOC_ALIGNMENT ? alignment : MALLOC_ALIGNMENT, size);
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+EXPORT void *aligned_alloc(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return aligned_malloc(alignment > MALLOC_ALIGNMENT ? alignment : MALLOC_ALIGNMENT, size);
+}
+
+EXPORT void *memalign(size_t alignment, size_t size) {
+    return aligned_alloc(alignment, size);
+}
+
+EXPORT void *valloc(size_t size) {
+    return aligned_malloc(sysconf(_SC_PAGESIZE), size);
+}
+
+EXPORT size_t malloc_usable_size(void *ptr) {
+    if (ptr == NULL) {
+        return 0;
+    }
+    pthread_mutex_lock(&heap_lock);
+    size_t size = usable_size(ptr);
+    pthread_mutex_unlock(&heap_lock);
+    return size;
+}
@@ -0,0 +1,290 @@
+/* File: recorder.c
+ * ----------------
+ * Records malloc traffic as a binary trace. Live blocks are found by
+ * address in an open-addressing hash table, and freed ids go on a stack
+ * to be handed out again. Both grow in memory from mmap, since malloc
+ * may be what is being recorded, and records are collected in a buffer
+ * that is written out with write(2) whenever it fills up. The header,
+ * with the request counts and number of ids, is written last.
+ */
+
+#define _GNU_SOURCE   // for mremap
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "recorder.h"
+#include "trace.h"
+
+#define OUTBUF_SIZE (1 << 16)
+#define MAX_PATH_LEN 4096
+#define INITIAL_CAPACITY 4096
+
+// a slot of the hash table, empty when ptr is 0
+typedef struct {
+    uintptr_t ptr;
+    int id;
+} slot_t;
+
+static int trace_fd = -1;
+static trace_header_t header;
+static uint8_t outbuf[OUTBUF_SIZE];
+static size_t outlen;
+static int prev_id;
+
+static slot_t *slots;
+static size_t capacity;     // number of slots, a power of two
+static size_t nlive;
+static int *free_ids;
+static size_t nfree;
+static size_t free_capacity;
+static int next_id;
+
+/* Function: map_array
+ * -------------------
+ * Grows an array kept in its own mapping to new_bytes, moving it if need
+ * be, or maps a new one if array is NULL. Returns NULL if that fails.
+ */
+static void *map_array(void *array, size_t old_bytes, size_t new_bytes) {
+    void *p = array == NULL
+        ? mmap(NULL, new_bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0)
+        : mremap(array, old_bytes, new_bytes, MREMAP_MAYMOVE);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+/* Function: find_slot
+ * -------------------
+ * Returns the index of the slot holding ptr, or of the empty slot where
+ * it would go.
+ */
+static size_t find_slot(uintptr_t ptr) {
+    size_t i = (ptr * 0x9e3779b97f4a7c15ULL >> 32) & (capacity - 1);
+    while (slots[i].ptr != 0 && slots[i].ptr != ptr) {
+        i = (i + 1) & (capacity - 1);
+    }
+    return i;
+}
+
+/* Function: grow_table
+ * --------------------
+ * Doubles the hash table and rehashes every live block into it. Returns
+ * false if there is no memory for it.
+ */
+static bool grow_table(void) {
+    slot_t *old_slots = slots;
+    size_t old_capacity = capacity;
+    size_t new_capacity = capacity == 0 ? INITIAL_CAPACITY : 2 * capacity;
+    slot_t *new_slots = map_array(NULL, 0, new_capacity * sizeof(slot_t));
+    if (new_slots == NULL) {
+        return false;
+    }
+    slots = new_slots;
+    capacity = new_capacity;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_slots[i].ptr != 0) {
+            slots[find_slot(old_slots[i].ptr)] = old_slots[i];
+        }
+    }
+    if (old_slots != NULL) {
+        munmap(old_slots, old_capacity * sizeof(slot_t));
+    }
+    return true;
+}
+
+/* Function: insert_block
+ * ----------------------
+ * Maps ptr to the given id. Returns false if the table can't grow.
+ */
+static bool insert_block(uintptr_t ptr, int id) {
+    if (2 * (nlive + 1) > capacity && !grow_table()) {
+        return false;
+    }
+    slots[find_slot(ptr)] = (slot_t){.ptr = ptr, .id = id};
+    nlive++;
+    return true;
+}
+
+/* Function: remove_block
+ * ----------------------
+ * Removes ptr from the table and returns its id, or -1 if it isn't there.
+ * The slots after it are shifted back so that no probe sequence is cut
+ * short, which saves marking deleted slots.
+ */
+static int remove_block(uintptr_t ptr) {
+    if (capacity == 0) {
+        return -1;
+    }
+    size_t i = find_slot(ptr);
+    if (slots[i].ptr == 0) {
+        return -1;
+    }
+    int id = slots[i].id;
+    size_t j = i;
+    while (true) {
+        j = (j + 1) & (capacity - 1);
+        if (slots[j].ptr == 0) {
+            break;
+        }
+        // the entry at j can move to i unless its home lies cyclically in (i, j]
+        size_t home = (slots[j].ptr * 0x9e3779b97f4a7c15ULL >> 32) & (capacity - 1);
+        if (((j - home) & (capacity - 1)) >= ((j - i) & (capacity - 1))) {
+            slots[i] = slots[j];
+            i = j;
+        }
+    }
+    slots[i].ptr = 0;
+    nlive--;
+    return id;
+}
+
+/* Function: write_all
+ * -------------------
+ * Writes len bytes to the trace file at the given offset, or at the
+ * current position if offset is negative. Returns false on an error.
+ */
+static bool write_all(const void *buf, size_t len, off_t offset) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = offset < 0 ? write(trace_fd, p, len) : pwrite(trace_fd, p, len, offset);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+        if (offset >= 0) {
+            offset += n;
+        }
+    }
+    return true;
+}
+
+/* Function: flush
+ * ---------------
+ * Writes out the buffered records, and stops recording if that fails.
+ */
+static void flush(void) {
+    if (!write_all(outbuf, outlen, -1)) {
+        close(trace_fd);
+        trace_fd = -1;
+    }
+    outlen = 0;
+}
+
+/* Function: put_record
+ * --------------------
+ * Adds one request to the trace.
+ */
+static void put_record(int op, int id, size_t size) {
+    if (outlen > OUTBUF_SIZE - (1 + 2 * TRACE_MAX_VARINT)) {
+        flush();
+    }
+    outlen += trace_put_record(outbuf + outlen, op, id, prev_id, size);
+    prev_id = id;
+    header.counts[op - TRACE_ALLOC]++;
+    header.num_ops++;
+}
+
+bool record_open(const char *path) {
+    // expand %p, by hand since snprintf may call malloc
+    char expanded[MAX_PATH_LEN];
+    size_t len = 0;
+    for (const char *p = path; *p != '\0' && len < sizeof(expanded) - 16; p++) {
+        if (p[0] == '%' && p[1] == 'p') {
+            char digits[16];
+            int ndigits = 0;
+            for (unsigned pid = getpid(); pid > 0 || ndigits == 0; pid /= 10) {
+                digits[ndigits++] = '0' + pid % 10;
+            }
+            while (ndigits > 0) {
+                expanded[len++] = digits[--ndigits];
+            }
+            p++;
+        } else {
+            expanded[len++] = *p;
+        }
+    }
+    expanded[len] = '\0';
+
+    trace_fd = open(expanded, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+    if (trace_fd < 0) {
+        return false;
+    }
+    // the header is written again at the end, once the counts are known
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, TRACE_MAGIC_LEN);
+    memcpy(outbuf, &header, sizeof(header));
+    outlen = sizeof(header);
+    return true;
+}
+
+void record_alloc(void *ptr, size_t size) {
+    if (trace_fd < 0) {
+        return;
+    }
+    if (nfree == 0 && next_id == INT32_MAX) {
+        return;
+    }
+    int id = nfree > 0 ? free_ids[nfree - 1] : next_id;
+    if (insert_block((uintptr_t)ptr, id)) {
+        if (nfree > 0) {
+            nfree--;
+        } else {
+            next_id++;
+        }
+        put_record(TRACE_ALLOC, id, size);
+    }
+}
+
+void record_realloc(void *old_ptr, void *new_ptr, size_t size) {
+    if (trace_fd < 0) {
+        return;
+    }
+    int id = remove_block((uintptr_t)old_ptr);
+    if (id >= 0) {
+        insert_block((uintptr_t)new_ptr, id);
+        put_record(TRACE_REALLOC, id, size);
+    }
+}
+
+void record_free(void *ptr) {
+    if (trace_fd < 0) {
+        return;
+    }
+    int id = remove_block((uintptr_t)ptr);
+    if (id < 0) {
+        return;
+    }
+    if (nfree == free_capacity) {
+        size_t new_capacity = free_capacity == 0 ? INITIAL_CAPACITY : 2 * free_capacity;
+        int *ids = map_array(free_ids, free_capacity * sizeof(int), new_capacity * sizeof(int));
+        if (ids == NULL) {
+            return;
+        }
+        free_ids = ids;
+        free_capacity = new_capacity;
+    }
+    free_ids[nfree++] = id;
+    put_record(TRACE_FREE, id, 0);
+}
+
+void record_close(void) {
+    if (trace_fd < 0) {
+        return;
+    }
+    flush();
+    header.num_ids = next_id;
+    if (trace_fd >= 0) {
+        write_all(&header, sizeof(header), 0);
+        close(trace_fd);
+        trace_fd = -1;
+    }
+}
+
+void record_abandon(void) {
+    if (trace_fd >= 0) {
+        close(trace_fd);
+        trace_fd = -1;
+    }
+    outlen = 0;
+}
@@ -0,0 +1,50 @@
+/* File: recorder.h
+ * ----------------
+ * Records the requests a program makes as a binary trace (see trace.h)
+ * that the test_ programs can replay. Every block handed out gets a block
+ * id, which it keeps through reallocs and gives back when it is freed, so
+ * ids are reused the way scripts reuse them.
+ *
+ * The recorder never calls malloc, so it can run inside a malloc
+ * replacement. None of the functions lock, so calls must be serialized
+ * by the caller.
+ */
+
+#ifndef _RECORDER_H_
+#define _RECORDER_H_
+#include <stdbool.h> // for bool
+#include <stddef.h>  // for size_t
+
+/* Function: record_open
+ * ---------------------
+ * Starts recording into the file at path, where "%p" stands for the
+ * process id. Returns false if the file can't be created.
+ */
+bool record_open(const char *path);
+
+/* Functions: record_alloc, record_realloc, record_free
+ * ----------------------------------------------------
+ * Record a request that succeeded: a new block at ptr, the block at
+ * old_ptr resized and now at new_ptr, or the block at ptr freed. They do
+ * nothing when not recording, and pointers that were never recorded
+ * are ignored.
+ */
+void record_alloc(void *ptr, size_t size);
+void record_realloc(void *old_ptr, void *new_ptr, size_t size);
+void record_free(void *ptr);
+
+/* Function: record_close
+ * ----------------------
+ * Writes out the rest of the trace along with its header and stops
+ * recording.
+ */
+void record_close(void);
+
+/* Function: record_abandon
+ * ------------------------
+ * Stops recording without writing anything, for a forked child whose
+ * parent goes on writing the trace.
+ */
+void record_abandon(void);
+
+#endif
@@ -1,13 +1,21 @@
 /* File: segment.c
  * ---------------
  * Handles low-level storage underneath the heap allocator. It reserves
- * the large memory segment using the OS-level mmap facility.
+ * the large memory segment using the OS-level mmap facility, with no
+ * access, and commits pages with mprotect as the allocator grows into it.
+ * Huge blocks can also get mappings of their own outside the segment;
+ * those are kept in a table sorted by address, so they can be found by
+ * binary search when they are checked and released.
  *
  * Written by jzelenski, updated Spring 2018
  */
 
+#define _GNU_SOURCE   // for mremap
 #include "segment.h"
 #include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 
 /* Place segment at fixed address, as default addresses are quite high
@@ -15,9 +23,59 @@
  */
 #define HEAP_START_HINT (void *)0x107000000L
 
+#define PAGE_SIZE 4096
+
 // Static means these variables are only visible within this file
 static void *segment_start = NULL;
 static size_t segment_size = 0;
+static size_t segment_reserved = 0;
+
+// Mappings made by map_huge_segment that are still live, by address
+typedef struct {
+    void *start;
+    size_t size;
+} huge_t;
+static huge_t *huge_maps = NULL;
+static size_t num_huge = 0;
+static size_t huge_capacity = 0;
+static size_t huge_total = 0;
+
+static size_t page_roundup(size_t nbytes) {
+    return (nbytes + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+}
+
+// Returns how many mappings start at or below ptr
+static size_t huge_rank(void *ptr) {
+    size_t lo = 0, hi = num_huge;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if ((char *)huge_maps[mid].start <= (char *)ptr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static huge_t *find_huge(void *start) {
+    size_t i = huge_rank(start);
+    if (i > 0 && huge_maps[i - 1].start == start) return &huge_maps[i - 1];
+    return NULL;
+}
+
+// Capacity must already be there for one more mapping
+static void insert_huge(huge_t map) {
+    size_t i = huge_rank(map.start);
+    memmove(&huge_maps[i + 1], &huge_maps[i], (num_huge - i) * sizeof(huge_t));
+    huge_maps[i] = map;
+    num_huge++;
+}
+
+static void remove_huge(huge_t *map) {
+    num_huge--;
+    memmove(map, map + 1, (size_t)(&huge_maps[num_huge] - map) * sizeof(huge_t));
+}
 
 void *heap_segment_start() {
     return segment_start;
@@ -27,17 +85,108 @@ size_t heap_segment_size() {
     return segment_size;
 }
 
+size_t heap_segment_resident() {
+    size_t npages = segment_size / PAGE_SIZE;
+    unsigned char *vec = malloc(npages > 0 ? npages : 1);
+    if (vec == NULL || mincore(segment_start, segment_size, vec) == -1) {
+        free(vec);
+        return 0;
+    }
+    size_t nresident = 0;
+    for (size_t i = 0; i < npages; i++) {
+        nresident += vec[i] & 1;
+    }
+    free(vec);
+    return nresident * PAGE_SIZE;
+}
+
 void *init_heap_segment(size_t total_size) {
+    // Huge mappings belong to the old heap as well
+    for (size_t i = 0; i < num_huge; i++) {
+        munmap(huge_maps[i].start, huge_maps[i].size);
+    }
+    num_huge = 0;
+    huge_total = 0;
+
     // Discard any previous segment via munmap
     if (segment_start != NULL) {
-        if (munmap(segment_start, total_size) == -1) return NULL;
+        if (munmap(segment_start, segment_reserved) == -1) return NULL;
         segment_start = NULL;
         segment_size = 0;
+        segment_reserved = 0;
     }
     
-    // Re-initialize by reserving entire segment with mmap
-    segment_start = mmap(HEAP_START_HINT, total_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    // Re-initialize by reserving entire segment with mmap, committing nothing
+    segment_start = mmap(HEAP_START_HINT, total_size, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
     assert(segment_start != MAP_FAILED);
-    segment_size = total_size;
+    segment_reserved = total_size;
     return segment_start;
 }
+
+void *extend_heap_segment(size_t nbytes) {
+    size_t grow = (nbytes + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+    if (segment_start == NULL || grow > segment_reserved - segment_size) return NULL;
+
+    // Commit the next pages of the reservation by making them accessible
+    void *old_end = (char *)segment_start + segment_size;
+    if (mprotect(old_end, grow, PROT_READ|PROT_WRITE) == -1) return NULL;
+    segment_size += grow;
+    return old_end;
+}
+
+void *map_huge_segment(size_t nbytes) {
+    size_t size = page_roundup(nbytes);
+    if (num_huge == huge_capacity) {
+        // Not realloc, which may be the allocator using this segment
+        size_t capacity = huge_capacity == 0 ? PAGE_SIZE / sizeof(huge_t) : 2 * huge_capacity;
+        huge_t *maps = huge_maps == NULL
+            ? mmap(NULL, capacity * sizeof(huge_t), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0)
+            : mremap(huge_maps, huge_capacity * sizeof(huge_t), capacity * sizeof(huge_t), MREMAP_MAYMOVE);
+        if (maps == MAP_FAILED) return NULL;
+        huge_maps = maps;
+        huge_capacity = capacity;
+    }
+    void *start = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (start == MAP_FAILED) return NULL;
+    insert_huge((huge_t){.start = start, .size = size});
+    huge_total += size;
+    return start;
+}
+
+void *remap_huge_segment(void *start, size_t nbytes) {
+    huge_t *map = find_huge(start);
+    if (map == NULL) return NULL;
+
+    // The kernel moves the page table entries, so no data is copied
+    size_t size = page_roundup(nbytes);
+    void *new_start = mremap(start, map->size, size, MREMAP_MAYMOVE);
+    if (new_start == MAP_FAILED) return NULL;
+    huge_total += size - map->size;
+    if (new_start == start) {
+        map->size = size;
+    } else {
+        remove_huge(map);
+        insert_huge((huge_t){.start = new_start, .size = size});
+    }
+    return new_start;
+}
+
+bool unmap_huge_segment(void *start) {
+    huge_t *map = find_huge(start);
+    if (map == NULL || munmap(start, map->size) == -1) return false;
+    huge_total -= map->size;
+    remove_huge(map);
+    return true;
+}
+
+bool in_huge_segment(void *ptr, size_t size) {
+    // Mappings don't overlap, so only the last one starting at or below ptr can hold it
+    size_t i = huge_rank(ptr);
+    if (i == 0) return false;
+    char *start = huge_maps[i - 1].start;
+    return (char *)ptr + size <= start + huge_maps[i - 1].size;
+}
+
+size_t huge_segments_size() {
+    return huge_total;
+}
@@ -1,18 +1,22 @@
 /* File: segment.h
  * ---------------
  * An interface to the OS low-level allocator. Used to reserve a large
- * segment of memory to be used by a custom heap allocator.
+ * segment of memory to be used by a custom heap allocator. The segment
+ * is only reserved up front; pages are committed as the heap grows.
  */
 
 #ifndef _SEGMENT_H_
 #define _SEGMENT_H_
+#include <stdbool.h> // for bool
 #include <stddef.h> // for size_t
 
 
 /* Function: init_heap_segment
  * ---------------------------
- * This function is called to initialize the heap segment and allocate the
- * segment to hold total_size bytes. If init_heap_segment 
+ * This function is called to initialize the heap segment and reserve
+ * address space for the segment to grow to total_size bytes. No memory is
+ * committed yet, so the segment starts out with a size of 0 and grows
+ * through extend_heap_segment. If init_heap_segment 
  * is called again, it discards the current heap segment and re-configures. 
  * The function returns the base address of the heap segment if successful 
  * or NULL if the initialization failed. The base address of the heap segment 
@@ -20,16 +24,58 @@
  */
 void *init_heap_segment(size_t total_size);
 
+/* Function: extend_heap_segment
+ * -----------------------------
+ * This function grows the heap segment by at least nbytes, rounded up to
+ * a whole number of pages, by committing more of the reserved address
+ * space. It returns the old end of the segment, which is where the new
+ * memory starts, or NULL if the reservation can't hold that much more.
+ * Call heap_segment_size afterwards for the new size.
+ */
+void *extend_heap_segment(size_t nbytes);
+
 
 
 /* Functions: heap_segment_start, heap_segment_size
  * ------------------------------------------------
  * heap_segment_start returns the base address of the current heap segment
  * (NULL if no segment has been initialized).
- * heap_segment_size returns the current segment size in bytes.
+ * heap_segment_size returns the current segment size in bytes, which is
+ * how much of the reservation has been committed so far.
  */
 void *heap_segment_start();
 size_t heap_segment_size();
 
+/* Function: heap_segment_resident
+ * -------------------------------
+ * This function returns how many bytes of the committed segment are
+ * actually backed by physical memory right now. Pages that were never
+ * touched, or that the allocator gave back with madvise, don't count.
+ */
+size_t heap_segment_resident();
+
+/* Functions: map_huge_segment, remap_huge_segment, unmap_huge_segment
+ * -------------------------------------------------------------------
+ * These functions give a huge block a mapping of its own, outside the
+ * heap segment. map_huge_segment maps at least nbytes, rounded up to a
+ * whole number of pages, and returns its start or NULL on failure.
+ * remap_huge_segment resizes a mapping made by map_huge_segment with
+ * mremap, which may move it without copying its contents, and returns
+ * its new start or NULL on failure (the old mapping is then untouched).
+ * unmap_huge_segment releases such a mapping right away. All huge
+ * mappings are released when init_heap_segment is called again.
+ */
+void *map_huge_segment(size_t nbytes);
+void *remap_huge_segment(void *start, size_t nbytes);
+bool unmap_huge_segment(void *start);
+
+/* Functions: in_huge_segment, huge_segments_size
+ * ----------------------------------------------
+ * in_huge_segment returns whether the size bytes at ptr lie within one
+ * live huge mapping. huge_segments_size returns the total size in bytes
+ * of all live huge mappings.
+ */
+bool in_huge_segment(void *ptr, size_t size);
+size_t huge_segments_size();
 
 #endif
@@ -0,0 +1,470 @@
+/* File: slab.c
+ * Author: Tiantian Fang
+ *
+ * This file contains my implementation of a slab ("big bag of pages")
+ * front end for small objects. It sits on top of the explicit allocator
+ * (see engine.h), which it uses both for requests bigger than
+ * SLAB_MAX_SIZE and as the source of the pages it carves up.
+ *
+ * Every slab page is SLAB_PAGE_SIZE bytes, aligned to its size, and holds
+ * objects of a single size class. The page starts with a small header
+ * holding its class and a bitmap of free slots; objects themselves have
+ * no header at all. myfree finds the page of an object by masking its
+ * address, and a bitmap with one bit per page of the heap segment says
+ * whether that page is a slab page or belongs to the engine. Pages are
+ * taken from the engine SLAB_SPAN_PAGES at a time. A page whose objects
+ * are all freed goes on a list of empty pages and can be reused by any
+ * class. The helpers here are static because this file is linked
+ * together with the engine, whose own helpers are global.
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "allocator.h"
+#include "engine.h"
+
+#define SLAB_PAGE_SIZE 4096
+#define SLAB_SPAN_PAGES 16
+
+// requests up to this size are served from slab pages
+#define SLAB_MAX_SIZE 256
+#define SLAB_NCLASSES 16
+
+// bitmap words needed to track the slots of the smallest class
+#define SLAB_MAP_WORDS 8
+
+// slab pages can only be placed in the first SLAB_MAX_SEGMENT bytes
+#define SLAB_MAX_SEGMENT (1UL << 32)
+#define SLAB_DIR_WORDS (SLAB_MAX_SEGMENT / SLAB_PAGE_SIZE / 64)
+
+struct SlabPage
+{
+    struct SlabPage *prev;   // neighbours in its class's partial list or
+    struct SlabPage *next;   // in the empty page list
+    int class;               // size class, or -1 for an empty page
+    int nfree;               // free slots
+    int nslots;              // slots in the page
+    uint64_t free_map[SLAB_MAP_WORDS];   // bit set for every free slot
+};
+
+// objects start right after the page header
+#define SLAB_HEADER_SIZE ((sizeof(struct SlabPage) + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1))
+
+static void *heap_start;
+static const size_t dir_pages = SLAB_MAX_SEGMENT / SLAB_PAGE_SIZE;
+static size_t dir_high_water;    // one past the highest slab page index
+static uint64_t slab_dir[SLAB_DIR_WORDS];
+
+// pages of each class with at least one free slot
+static struct SlabPage *partial_pages[SLAB_NCLASSES];
+static struct SlabPage *empty_pages;
+
+/* Function: class_of_request
+ *
+ * Parameters:
+ * size - requested size, between 1 and SLAB_MAX_SIZE
+ *
+ * Returns:
+ * the smallest size class that can hold the request
+ *
+ * Classes step by 8 bytes up to 64, by 16 up to 128 and by 32 up to 256.
+ */
+static int class_of_request(size_t size) {
+    if (size <= 64) {
+        return (size - 1) / 8;
+    }
+    if (size <= 128) {
+        return 8 + (size - 65) / 16;
+    }
+    return 12 + (size - 129) / 32;
+}
+
+/* Function: class_size
+ *
+ * Parameters:
+ * class - a size class
+ *
+ * Returns:
+ * the object size of the class
+ */
+static size_t class_size(int class) {
+    if (class < 8) {
+        return (class + 1) * 8;
+    }
+    if (class < 12) {
+        return 64 + (class - 7) * 16;
+    }
+    return 128 + (class - 11) * 32;
+}
+
+/* Function: page_index
+ *
+ * Parameters:
+ * ptr - any address
+ *
+ * Returns:
+ * index of the segment page holding the address, or dir_pages if the
+ * address is outside the part of the segment the directory covers
+ */
+static size_t page_index(void *ptr) {
+    if ((char *)ptr < (char *)heap_start) {
+        return dir_pages;
+    }
+    size_t index = ((char *)ptr - (char *)heap_start) / SLAB_PAGE_SIZE;
+    return index < dir_pages ? index : dir_pages;
+}
+
+/* Function: page_of
+ *
+ * Parameters:
+ * ptr - pointer to a payload
+ *
+ * Returns:
+ * the slab page holding the payload, or NULL if it is an engine block
+ */
+static struct SlabPage *page_of(void *ptr) {
+    size_t index = page_index(ptr);
+    if (index == dir_pages || !((slab_dir[index / 64] >> (index % 64)) & 1)) {
+        return NULL;
+    }
+    return (struct SlabPage *)((uintptr_t)ptr & ~(uintptr_t)(SLAB_PAGE_SIZE - 1));
+}
+
+/* Function: push_page
+ *
+ * Parameters:
+ * listp - list to push onto
+ * page - a page that is in no list
+ */
+static void push_page(struct SlabPage **listp, struct SlabPage *page) {
+    page->prev = NULL;
+    page->next = *listp;
+    if (*listp != NULL) {
+        (*listp)->prev = page;
+    }
+    *listp = page;
+}
+
+/* Function: unlink_page
+ *
+ * Parameters:
+ * listp - list holding the page
+ * page - page to remove
+ */
+static void unlink_page(struct SlabPage **listp, struct SlabPage *page) {
+    if (page->prev != NULL) {
+        page->prev->next = page->next;
+    }
+    else {
+        *listp = page->next;
+    }
+    if (page->next != NULL) {
+        page->next->prev = page->prev;
+    }
+}
+
+/* Function: add_span
+ *
+ * Returns:
+ * whether new empty pages could be added
+ *
+ * This function takes a block from the engine that is big enough to hold
+ * SLAB_SPAN_PAGES aligned pages, gives the slack after the last page back
+ * to the engine by shrinking the block, which must not move it, registers
+ * the pages in the directory and puts them on the empty page list.
+ */
+static bool add_span(void) {
+    char *span = engine_malloc((SLAB_SPAN_PAGES + 1) * SLAB_PAGE_SIZE - ALIGNMENT);
+    if (span == NULL) {
+        return false;
+    }
+    char *first_page = (char *)(((uintptr_t)span + SLAB_PAGE_SIZE - 1)
+                                & ~(uintptr_t)(SLAB_PAGE_SIZE - 1));
+    size_t first_index = page_index(first_page);
+    if (first_index + SLAB_SPAN_PAGES > dir_pages) {
+        engine_free(span);
+        return false;
+    }
+    //the engine shrinks a block in place, so the pages stay where they are;
+    //if it ever moved the block, the pages would be freed memory
+    char *kept = engine_realloc(span, first_page + SLAB_SPAN_PAGES * SLAB_PAGE_SIZE - span);
+    assert(kept == span);
+    (void)kept;
+
+    for (int i = SLAB_SPAN_PAGES - 1; i >= 0; i--) {
+        struct SlabPage *page = (struct SlabPage *)(first_page + i * SLAB_PAGE_SIZE);
+        size_t index = first_index + i;
+        slab_dir[index / 64] |= 1UL << (index % 64);
+        page->class = -1;
+        push_page(&empty_pages, page);
+    }
+    if (first_index + SLAB_SPAN_PAGES > dir_high_water) {
+        dir_high_water = first_index + SLAB_SPAN_PAGES;
+    }
+    return true;
+}
+
+/* Function: format_page
+ *
+ * Parameters:
+ * class - size class the page will hold
+ *
+ * Returns:
+ * an empty page set up for the class, or NULL if no page is available
+ *
+ * This function takes a page off the empty list (adding a span if the
+ * list is empty), marks all of its slots free and makes it a partial
+ * page of the class.
+ */
+static struct SlabPage *format_page(int class) {
+    if (empty_pages == NULL && !add_span()) {
+        return NULL;
+    }
+    struct SlabPage *page = empty_pages;
+    unlink_page(&empty_pages, page);
+
+    page->class = class;
+    page->nslots = (SLAB_PAGE_SIZE - SLAB_HEADER_SIZE) / class_size(class);
+    page->nfree = page->nslots;
+    memset(page->free_map, 0, sizeof(page->free_map));
+    for (int slot = 0; slot < page->nslots; slot++) {
+        page->free_map[slot / 64] |= 1UL << (slot % 64);
+    }
+    push_page(&partial_pages[class], page);
+    return page;
+}
+
+/* Function: myinit
+ *
+ * Parameters:
+ * start - pointer to the start of heap
+ * size - size of heap
+ *
+ * Returns:
+ * if the initialization was successful
+ *
+ * This function resets the engine and forgets every slab page.
+ */
+bool myinit(void *start, size_t size) {
+    heap_start = start;
+    memset(slab_dir, 0, (dir_high_water + 63) / 64 * sizeof(uint64_t));
+    dir_high_water = 0;
+    memset(partial_pages, 0, sizeof(partial_pages));
+    empty_pages = NULL;
+    return engine_init(start, size);
+}
+
+/* Function: mymalloc
+ *
+ * Parameters:
+ * requested_size - requested size to be allocated
+ *
+ * Returns:
+ * pointer to the payload of the block that the requested size can fit in
+ *
+ * This function hands out the first free slot of a partial page of the
+ * request's class. Big requests, and small ones when no page can be
+ * had, go to the engine.
+ */
+void *mymalloc(size_t requested_size) {
+    if (requested_size == 0 || requested_size > MAX_REQUEST_SIZE) {
+        return NULL;
+    }
+    if (requested_size > SLAB_MAX_SIZE) {
+        return engine_malloc(requested_size);
+    }
+
+    int class = class_of_request(requested_size);
+    struct SlabPage *page = partial_pages[class];
+    if (page == NULL && (page = format_page(class)) == NULL) {
+        return engine_malloc(requested_size);
+    }
+
+    int word = 0;
+    while (page->free_map[word] == 0) {
+        word++;
+    }
+    int slot = word * 64 + __builtin_ctzl(page->free_map[word]);
+    page->free_map[word] &= ~(1UL << (slot % 64));
+    if (--page->nfree == 0) {
+        unlink_page(&partial_pages[class], page);
+    }
+    return (char *)page + SLAB_HEADER_SIZE + slot * class_size(class);
+}
+
+/* Function: myfree
+ *
+ * Parameters:
+ * ptr - pointer to the payload to be freed
+ *
+ * This function marks a slab object's slot free, putting a full page
+ * back on its class's partial list and retiring a page that became empty
+ * unless it is the only partial page of its class. Engine blocks are
+ * freed by the engine.
+ */
+void myfree(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    struct SlabPage *page = page_of(ptr);
+    if (page == NULL) {
+        engine_free(ptr);
+        return;
+    }
+
+    int class = page->class;
+    int slot = ((char *)ptr - (char *)page - SLAB_HEADER_SIZE) / class_size(class);
+    if ((page->free_map[slot / 64] >> (slot % 64)) & 1) {
+        return;
+    }
+    page->free_map[slot / 64] |= 1UL << (slot % 64);
+    if (page->nfree++ == 0) {
+        push_page(&partial_pages[class], page);
+    }
+    if (page->nfree == page->nslots
+        && (partial_pages[class] != page || page->next != NULL)) {
+        unlink_page(&partial_pages[class], page);
+        page->class = -1;
+        push_page(&empty_pages, page);
+    }
+}
+
+/* Function: myrealloc
+ *
+ * Parameters:
+ * old_ptr - pointer to the payload to be reallocated
+ * new_size - the new size requested
+ *
+ * This function reallocates a previously allocated block. A slab object
+ * stays put if the new size still fits its slot, engine blocks are
+ * resized by the engine, and anything else moves.
+ */
+void *myrealloc(void *old_ptr, size_t new_size) {
+    if (old_ptr == NULL) {
+        return mymalloc(new_size);
+    }
+    else if (new_size == 0) {
+        myfree(old_ptr);
+        return NULL;
+    }
+    else if (new_size > MAX_REQUEST_SIZE) {
+        return NULL;
+    }
+
+    struct SlabPage *page = page_of(old_ptr);
+    if (page == NULL) {
+        return engine_realloc(old_ptr, new_size);
+    }
+    size_t old_size = class_size(page->class);
+    if (new_size <= old_size) {
+        return old_ptr;
+    }
+
+    void *new_ptr = mymalloc(new_size);
+    if (new_ptr != NULL) {
+        memcpy(new_ptr, old_ptr, old_size);
+        myfree(old_ptr);
+    }
+    return new_ptr;
+}
+
+/* Function: mytrim
+ *
+ * Returns: 
+ * number of bytes given back to the OS
+ *
+ * This function trims the engine. Slab pages, even empty ones, are
+ * engine blocks in use and keep their memory.
+ */
+size_t mytrim() {
+    return engine_trim();
+}
+
+/* Function: myheap_stats
+ *
+ * Parameters:
+ * stats - where to store the snapshot
+ *
+ * This function reports the engine's snapshot. Slab pages are engine
+ * blocks in use, so the free slots inside them count as live bytes.
+ */
+void myheap_stats(struct heap_stats *stats) {
+    engine_heap_stats(stats);
+}
+
+/* Function: validate_heap
+ *
+ * Return true if all is ok, or false otherwise.
+ * This function is called periodically by the test
+ * harness to check the state of the heap allocator.
+ * It checks the engine, then every page in the directory: its class,
+ * slot count and free count must agree with its bitmap, and the pages
+ * with free slots must be exactly the pages on the partial lists.
+ */
+bool validate_heap() {
+    if (!engine_validate_heap()) {
+        return false;
+    }
+
+    size_t npartial = 0;
+    size_t nempty = 0;
+    for (size_t index = 0; index < dir_high_water; index++) {
+        if (!((slab_dir[index / 64] >> (index % 64)) & 1)) {
+            continue;
+        }
+        struct SlabPage *page = (struct SlabPage *)((char *)heap_start + index * SLAB_PAGE_SIZE);
+        if (page->class == -1) {
+            nempty++;
+            continue;
+        }
+        if (page->class < 0 || page->class >= SLAB_NCLASSES
+            || page->nslots != (int)((SLAB_PAGE_SIZE - SLAB_HEADER_SIZE) / class_size(page->class))) {
+            printf("Slab page at address %p has a bad class or slot count.\n", page);
+            return false;
+        }
+        int nfree = 0;
+        for (int word = 0; word < SLAB_MAP_WORDS; word++) {
+            nfree += __builtin_popcountl(page->free_map[word]);
+        }
+        if (nfree != page->nfree || nfree > page->nslots) {
+            printf("Slab page at address %p counts %d free slots but its bitmap has %d.\n",
+                   page, page->nfree, nfree);
+            return false;
+        }
+        if (nfree > 0) {
+            npartial++;
+        }
+    }
+
+    size_t nlisted = 0;
+    for (int class = 0; class < SLAB_NCLASSES; class++) {
+        for (struct SlabPage *page = partial_pages[class]; page != NULL; page = page->next) {
+            if (page->class != class || page->nfree == 0 || page_of(page) != page) {
+                printf("Slab page at address %p doesn't belong on partial list %d.\n", page, class);
+                return false;
+            }
+            nlisted++;
+        }
+    }
+    if (nlisted != npartial) {
+        printf("Partial lists hold %zu pages but %zu pages have free slots.\n", nlisted, npartial);
+        return false;
+    }
+
+    nlisted = 0;
+    for (struct SlabPage *page = empty_pages; page != NULL; page = page->next) {
+        if (page->class != -1 || page_of(page) != page) {
+            printf("Slab page at address %p doesn't belong on the empty list.\n", page);
+            return false;
+        }
+        nlisted++;
+    }
+    if (nlisted != nempty) {
+        printf("Empty list holds %zu pages but %zu pages are empty.\n", nlisted, nempty);
+        return false;
+    }
+    return true;
+}
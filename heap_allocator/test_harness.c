@@ -2,26 +2,40 @@
  * Files: test_harness.c
  * ---------------------
  * Reads and interprets text-based script files containing a sequence of
- * allocator requests. Runs the allocator on a script and validates
- * results for correctness.
+ * allocator requests, or packed binary traces of them (see trace.h), which
+ * are mapped into memory and decoded as they are replayed. Runs the
+ * allocator on a script and validates results for correctness. With -b
+ * it instead times every request and reports throughput and latency
+ * percentiles per request type, optionally also as JSON (-j file) for
+ * comparing allocator builds.
  *
- * When you compile using `make`, it will create 3 different
- * compiled versions of this program, one using each type of
- * heap allocator.
+ * When you compile using `make`, it will create a compiled version of
+ * this program for each heap allocator (test_implicit, test_explicit,
+ * test_bump, test_tlsf, test_threaded and test_slab) and for each build
+ * variant of the explicit allocator (test_explicit_firstfit and the
+ * other fit policies, test_explicit_quick and test_explicit_addrorder).
  *
  * Written by jzelenski, updated by Nick Troccoli Winter 18-19
  */
 
+#include <errno.h>
 #include <error.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 #include "allocator.h"
 #include "segment.h"
+#include "trace.h"
 
 
 /* TYPE DECLARATIONS */
@@ -29,53 +43,109 @@
 
 // enum and struct for a single allocator request
 enum request_type {
-    ALLOC = 1,
-    FREE,
-    REALLOC
+    ALLOC = TRACE_ALLOC,
+    FREE = TRACE_FREE,
+    REALLOC = TRACE_REALLOC
 };
+#define NUM_REQUEST_TYPES 3
 typedef struct {
     enum request_type op;   // type of request
     int id;                 // id for free() to use later
     size_t size;            // num bytes for alloc/realloc request
-    int lineno;             // which line in file
+    int lineno;             // which line in file (request number in a trace)
 } request_t;
 
 // struct for facts about a single malloc'ed block
 typedef struct {
     void *ptr;
     size_t size;
+    int left, right;    // children in the address index of live blocks, or -1
 } block_t;
 
+// placements of blocks are grouped in windows of this many to count the
+// pages they touch
+#define LOCALITY_WINDOW 64
+
 // struct for info for one script file
 typedef struct {
     char name[128];     // short name of script
-    request_t *ops;     // array of requests read from script
+    request_t *ops;     // array of requests read from script, NULL for a trace
     int num_ops;        // number of requests
+    int counts[NUM_REQUEST_TYPES];  // requests of each type, indexed by op - ALLOC
     int num_ids;        // number of distinct block ids
+    const uint8_t *trace;   // mapped binary trace, NULL for a text script
+    size_t trace_len;
+    const uint8_t *cursor;  // next record of the trace to replay
+    int prev_id;            // id of the request before the cursor
     block_t *blocks;    // array of memory blocks malloc returns when executing
+    int index_root;     // id of the root of the address index, -1 if empty
     size_t peak_size;   // total payload bytes at peak in-use
+    size_t resident_size;   // resident segment bytes at the end of the script
+    size_t trimmed_size;    // resident segment bytes after mytrim
+    struct heap_stats peak_stats;   // myheap_stats at the peak
+    struct heap_stats end_stats;    // myheap_stats after the last request
+    size_t placements;      // blocks placed in the heap by malloc or a moving realloc
+    size_t near_placements; // of those, placed within a page of the one before
+    size_t window_pages;    // distinct pages summed over every full window
+    uint64_t window[LOCALITY_WINDOW];   // pages of the current window's placements
+    char *last_placed;      // block placed last, NULL for none yet
 } script_t;
 
-// Amount by which we resize ops when needed when reading in from file
-const int OPS_RESIZE_AMOUNT = 500;
+// struct for the timing results of one type of request in a script
+typedef struct {
+    int count;          // requests of this type
+    double ops_per_sec; // requests per second of time spent in them
+    double mean_ns;     // mean latency
+    uint64_t p50_ns;    // latency percentiles
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+} latency_t;
+
+// names of the request types, indexed by op - ALLOC
+static const char *const REQUEST_NAMES[] = {"malloc", "free", "realloc"};
+
+// Initial size of ops when reading in from file, doubled whenever it fills up
+const int OPS_INITIAL_CAPACITY = 500;
 
 const int MAX_SCRIPT_LINE_LEN = 1024;
 
 const long HEAP_SIZE = 1L << 32;
 
+const size_t LOCALITY_PAGE = 4096;
+
 
 /* FUNCTION PROTOTYPES */
 
 
 static int test_scripts(char *script_names[], int num_script_names, bool quiet);
+static int bench_scripts(char *script_names[], int num_script_names,
+    const char *allocator_name, FILE *json);
+static void write_json_string(FILE *json, const char *str);
 static bool read_line(char buffer[], size_t buffer_size, FILE *fp, int *pnread);
+static script_t load_script(const char *path);
+static void set_script_name(script_t *script, const char *path);
 static script_t parse_script(const char *filename);
+static script_t map_trace(const char *path, int fd);
 static request_t parse_script_line(char *buffer, int i, int lineno, char *script_name);
+static void rewind_script(script_t *script);
+static request_t next_request(script_t *script, int req);
+static void free_script(script_t *script);
+static void print_heap_stats(const struct heap_stats *stats);
+static void print_heap_work(const struct heap_stats *stats);
+static void record_placement(script_t *script, void *ptr, size_t size);
+static void print_locality(const script_t *script);
+static int compare_samples(const void *a, const void *b);
 static size_t eval_correctness(script_t *script, bool quiet, bool *success);
-static void *eval_malloc(int req, size_t requested_size, script_t *script, bool *failptr);
-static void *eval_realloc(int req, size_t requested_size, script_t *script, bool *failptr);
+static void *eval_malloc(request_t *request, script_t *script, bool *failptr);
+static void *eval_realloc(request_t *request, script_t *script, bool *failptr);
+static void set_block(script_t *script, int id, void *ptr, size_t size);
+static void index_insert(script_t *script, int id);
+static void index_remove(script_t *script, int id);
 static bool verify_block(void *ptr, size_t size, script_t *script, int lineno);
 static bool verify_payload(void *ptr, size_t size, int id, script_t *script, int lineno, char *op);
+static bool eval_performance(script_t *script, latency_t stats[], double *pseconds);
+static uint64_t time_ns(void);
+static void summarize_latencies(uint64_t samples[], int count, latency_t *stats);
 static void allocator_error(script_t *script, int lineno, char* format, ...);
 
 
@@ -84,27 +154,52 @@ static void allocator_error(script_t *script, int lineno, char* format, ...);
 
 /* Function: main
  * --------------
- * The main function parses command-line arguments (currently only -q for quiet)
+ * The main function parses command-line arguments (-q for quiet, -b for
+ * benchmark mode and -j file to also write benchmark results as JSON)
  * and any script files that follow and runs the heap allocator on the specified
  * script files.  It outputs statistics about the run of each script, such as
- * the number of successful runs, number of failures, and average utilization.
+ * the number of successful runs, number of failures, and average utilization,
+ * or in benchmark mode the throughput and latencies of each request type.
  */
 int main(int argc, char *argv[]) {
     // Parse command line arguments
     char c;
     bool quiet = false;
-    while ((c = getopt(argc, argv, "q")) != EOF) {
+    bool bench = false;
+    const char *json_path = NULL;
+    while ((c = getopt(argc, argv, "qbj:")) != EOF) {
         if (c == 'q') {
             quiet = true;
+        } else if (c == 'b') {
+            bench = true;
+        } else if (c == 'j') {
+            json_path = optarg;
+        } else {
+            error(1, 0, "Usage: %s [-q] [-b [-j json_file]] script_file ...", argv[0]);
         }
     }
     if (optind >= argc) {
         error(1, 0, "Missing argument. Please supply one or more script files.");
     }
+    if (json_path != NULL && !bench) {
+        error(1, 0, "-j only applies to benchmark mode (-b).");
+    }
 
     // disable stdout buffering, all printfs display to terminal immediately
     setvbuf(stdout, NULL, _IONBF, 0);
     
+    if (bench) {
+        FILE *json = NULL;
+        if (json_path != NULL && (json = fopen(json_path, "w")) == NULL) {
+            error(1, 0, "Could not open JSON file \"%s\".", json_path);
+        }
+        const char *allocator_name = strrchr(argv[0], '/') ? strrchr(argv[0], '/') + 1 : argv[0];
+        int nfailures = bench_scripts(argv + optind, argc - optind, allocator_name, json);
+        if (json != NULL) {
+            fclose(json);
+        }
+        return nfailures;
+    }
     return test_scripts(argv + optind, argc - optind, quiet);
 }
 
@@ -122,7 +217,7 @@ static int test_scripts(char *script_names[], int num_script_names, bool quiet)
     int total_util = 0;
 
     for (int i = 0; i < num_script_names; i++) {
-        script_t script = parse_script(script_names[i]);
+        script_t script = load_script(script_names[i]);
 
         // Evaluate this script and record the results
         printf("\nEvaluating allocator on %s...", script.name);
@@ -131,6 +226,11 @@ static int test_scripts(char *script_names[], int num_script_names, bool quiet)
         if (success) {
             printf("successfully serviced %d requests. (payload/segment = %zu/%zu)", 
                 script.num_ops, script.peak_size, used_segment);
+            printf(" (resident = %zu, %zu after mytrim)",
+                script.resident_size, script.trimmed_size);
+            print_heap_stats(&script.peak_stats);
+            print_heap_work(&script.end_stats);
+            print_locality(&script);
             if (used_segment > 0) {
                 total_util += (100 * script.peak_size) / used_segment;
             }
@@ -139,8 +239,7 @@ static int test_scripts(char *script_names[], int num_script_names, bool quiet)
             nfailures++;
         }
 
-        free(script.ops);
-        free(script.blocks);
+        free_script(&script);
     }
 
     if (nsuccesses) {
@@ -149,6 +248,87 @@ static int test_scripts(char *script_names[], int num_script_names, bool quiet)
     return nfailures;
 }
 
+/* Function: print_heap_stats
+ * --------------------------
+ * Prints a heap snapshot on two lines: the totals, then how many free
+ * blocks fall in each power-of-two size range.
+ */
+static void print_heap_stats(const struct heap_stats *stats) {
+    printf("\n  at peak: %zu bytes live in %zu blocks, %zu free in %zu blocks,"
+        " largest free %zu, fragmentation %.2f",
+        stats->live_bytes, stats->live_blocks, stats->free_bytes, stats->free_blocks,
+        stats->largest_free, stats->fragmentation);
+    printf("\n  free blocks by size:");
+    for (int bucket = 0; bucket < HEAP_STATS_BUCKETS; bucket++) {
+        if (stats->free_histogram[bucket] > 0) {
+            printf(" %zu-%zu:%zu", (size_t)1 << bucket, ((size_t)2 << bucket) - 1,
+                stats->free_histogram[bucket]);
+        }
+    }
+}
+
+/* Function: print_heap_work
+ * -------------------------
+ * Prints how many splits and merges of free blocks the allocator did over
+ * the whole script and how many requests its quick lists served without
+ * either, if it counts them at all.
+ */
+static void print_heap_work(const struct heap_stats *stats) {
+    if (stats->splits + stats->coalesces + stats->quick_allocs + stats->quick_frees == 0) {
+        return;
+    }
+    printf("\n  work: %zu splits, %zu coalesces, %zu mallocs and %zu frees on quick lists",
+        stats->splits, stats->coalesces, stats->quick_allocs, stats->quick_frees);
+}
+
+/* Function: record_placement
+ * ----------------------------
+ * Notes where the allocator placed a new block, as a stand-in for how
+ * cache friendly its placement is: blocks allocated one after another
+ * tend to be used together, so the fewer pages they are spread over the
+ * better. Empty blocks and blocks outside the heap segment don't count.
+ */
+static void record_placement(script_t *script, void *ptr, size_t size) {
+    if (ptr == NULL || size == 0 || in_huge_segment(ptr, size)) {
+        return;
+    }
+    char *p = ptr;
+    if (script->last_placed != NULL && (size_t)labs(p - script->last_placed) < LOCALITY_PAGE) {
+        script->near_placements++;
+    }
+    script->last_placed = p;
+
+    script->window[script->placements++ % LOCALITY_WINDOW] = (uintptr_t)p / LOCALITY_PAGE;
+    if (script->placements % LOCALITY_WINDOW == 0) {
+        qsort(script->window, LOCALITY_WINDOW, sizeof(uint64_t), compare_samples);
+        script->window_pages++;
+        for (int i = 1; i < LOCALITY_WINDOW; i++) {
+            if (script->window[i] != script->window[i - 1]) {
+                script->window_pages++;
+            }
+        }
+    }
+}
+
+/* Function: print_locality
+ * ------------------------
+ * Prints how often a block was placed within a page of the block placed
+ * before it, and how many distinct pages each window of LOCALITY_WINDOW
+ * placements touched on average.
+ */
+static void print_locality(const script_t *script) {
+    if (script->placements < 2) {
+        return;
+    }
+    printf("\n  locality: %.0f%% of blocks placed within a page of the one before",
+        100.0 * script->near_placements / (script->placements - 1));
+    size_t windows = script->placements / LOCALITY_WINDOW;
+    if (windows > 0) {
+        printf(", %.1f pages per %d blocks", (double)script->window_pages / windows,
+            LOCALITY_WINDOW);
+    }
+}
+
 /* Function: eval_correctness
  * --------------------------
  * Check the allocator for correctness on given script. Interprets the
@@ -158,6 +338,7 @@ static int test_scripts(char *script_names[], int num_script_names, bool quiet)
  */
 static size_t eval_correctness(script_t *script, bool quiet, bool *success) {
     *success = false;
+    script->index_root = -1;
     
     init_heap_segment(HEAP_SIZE);
     if (!myinit(heap_segment_start(), heap_segment_size())) {
@@ -170,66 +351,106 @@ static size_t eval_correctness(script_t *script, bool quiet, bool *success) {
         return -1;
     }
 
-    // Track the topmost address used by the heap for utilization purposes
+    // Track the topmost address used by the heap for utilization purposes,
+    // plus the most memory mapped for huge blocks outside the segment
     void *heap_end = heap_segment_start();
+    size_t huge_peak = 0;
 
     // Track the current amount of memory allocated on the heap
     size_t cur_size = 0;
 
+    // The heap snapshot at the peak is only taken once the heap is about to
+    // change without making a new peak, since in some allocators
+    // myheap_stats walks the whole heap
+    bool peak_pending = false;
+
     // Send each request to the heap allocator and check the resulting behavior
+    rewind_script(script);
     for (int req = 0; req < script->num_ops; req++) {
-        int id = script->ops[req].id;
-        size_t requested_size = script->ops[req].size;
+        request_t request = next_request(script, req);
+        int id = request.id;
+        size_t requested_size = request.size;
+
+        bool raises_peak = request.op == ALLOC ? requested_size > 0
+            : request.op == REALLOC && requested_size > script->blocks[id].size;
+        if (peak_pending && !raises_peak) {
+            myheap_stats(&script->peak_stats);
+            peak_pending = false;
+        }
 
-        if (script->ops[req].op == ALLOC) {
+        if (request.op == ALLOC) {
             bool fail = false;
-            void *p = eval_malloc(req, requested_size, script, &fail);
+            void *p = eval_malloc(&request, script, &fail);
             if (fail) {
                 return -1;
             }
 
             cur_size += requested_size;
-            if ((char *)p + requested_size > (char *)heap_end) {
+            record_placement(script, p, requested_size);
+            if ((char *)p + requested_size > (char *)heap_end
+                && !in_huge_segment(p, requested_size)) {
                 heap_end = (char *)p + requested_size;
             }
-        } else if (script->ops[req].op == REALLOC) {
+        } else if (request.op == REALLOC) {
             size_t old_size = script->blocks[id].size;
+            void *old_ptr = script->blocks[id].ptr;
             bool fail = false;
-            void *p = eval_realloc(req, requested_size, script, &fail);
+            void *p = eval_realloc(&request, script, &fail);
             if (fail) {
                 return -1;
             }
+            if (p != old_ptr) {
+                record_placement(script, p, requested_size);
+            }
 
             cur_size += (requested_size - old_size);
-            if ((char *)p + requested_size > (char *)heap_end) {
+            if ((char *)p + requested_size > (char *)heap_end
+                && !in_huge_segment(p, requested_size)) {
                 heap_end = (char *)p + requested_size;
             }
-        } else if (script->ops[req].op == FREE) {
+        } else if (request.op == FREE) {
             size_t old_size = script->blocks[id].size;
             void *p = script->blocks[id].ptr;
 
             // verify payload intact before free
             if (!verify_payload(p, old_size, id, script, 
-                script->ops[req].lineno, "freeing")) {
+                request.lineno, "freeing")) {
                 return -1;
             }
-            script->blocks[id] = (block_t){.ptr = NULL, .size = 0};
+            set_block(script, id, NULL, 0);
             myfree(p);
             cur_size -= old_size;
         }
 
         // check heap consistency after each request and stop if any error
         if (!quiet && !validate_heap()) {
-            allocator_error(script, script->ops[req].lineno, 
+            allocator_error(script, request.lineno, 
                 "validate_heap() returned false, called in-between requests");
             return -1;
         }
 
         if (cur_size > script->peak_size) {
             script->peak_size = cur_size;
+            peak_pending = true;
+        }
+        if (huge_segments_size() > huge_peak) {
+            huge_peak = huge_segments_size();
         }
     }
 
+    // give free memory back to the OS, which must not disturb live blocks
+    myheap_stats(&script->end_stats);
+    if (peak_pending) {
+        script->peak_stats = script->end_stats;
+    }
+    script->resident_size = heap_segment_resident();
+    mytrim();
+    script->trimmed_size = heap_segment_resident();
+    if (!quiet && !validate_heap()) {
+        allocator_error(script, 0, "validate_heap() after mytrim returned false");
+        return -1;
+    }
+
     // verify payload is still intact for any block still allocated
     for (int id = 0; id < script->num_ids; id++) {
         if (!verify_payload(script->blocks[id].ptr, script->blocks[id].size, 
@@ -239,27 +460,27 @@ static size_t eval_correctness(script_t *script, bool quiet, bool *success) {
     }
 
     *success = true;
-    return (char *)heap_end - (char *)heap_segment_start();
+    return (char *)heap_end - (char *)heap_segment_start() + huge_peak;
 }
 
 /* Function: eval_malloc
  * ---------------------
- * Performs a test of a call to mymalloc of the given size.  The req number
- * specifies the operation's index within the script.  This function verifies
+ * Performs a test of a call to mymalloc for the given request of the
+ * script.  This function verifies
  * the entire malloc'ed block and fills in the payload with a low-order byte
  * of the request id.  If the request fails, the boolean pointed to by
  * failptr is set to true - otherwise, it is set to false.  If it is set to
  * true this function returns NULL; otherwise, it returns what was returned
  * by mymalloc.
  */
-static void *eval_malloc(int req, size_t requested_size, script_t *script, 
-    bool *failptr) {
+static void *eval_malloc(request_t *request, script_t *script, bool *failptr) {
 
-    int id = script->ops[req].id;
+    int id = request->id;
+    size_t requested_size = request->size;
 
     void *p;
     if ((p = mymalloc(requested_size)) == NULL && requested_size != 0) {
-        allocator_error(script, script->ops[req].lineno, 
+        allocator_error(script, request->lineno, 
             "heap exhausted, malloc returned NULL");
         *failptr = true;
         return NULL;
@@ -268,7 +489,7 @@ static void *eval_malloc(int req, size_t requested_size, script_t *script,
     /* Test new block for correctness: must be properly aligned
      * and must not overlap any currently allocated block.
      */
-    if (!verify_block(p, requested_size, script, script->ops[req].lineno)) {
+    if (!verify_block(p, requested_size, script, request->lineno)) {
         *failptr = true;
         return NULL;
     }
@@ -277,72 +498,166 @@ static void *eval_malloc(int req, size_t requested_size, script_t *script,
      * can be used later to verify data copied when realloc'ing.
      */
     memset(p, id & 0xFF, requested_size);
-    script->blocks[id] = (block_t){.ptr = p, .size = requested_size};
+    set_block(script, id, p, requested_size);
     *failptr = false;
     return p;
 }
 
 /* Function: eval_realloc
  * ---------------------
- * Performs a test of a call to myrealloc of the given size.  The req number
- * specifies the operation's index within the script.  This function verifies
+ * Performs a test of a call to myrealloc for the given request of the
+ * script.  This function verifies
  * the entire realloc'ed block and fills in the payload with a low-order byte
  * of the request id.  If the request fails, the boolean pointed to by
  * failptr is set to true - otherwise, it is set to false.  If it is set to true
  * this function returns NULL; otherwise, it returns what was returned by
  * myrealloc.
  */
-static void *eval_realloc(int req, size_t requested_size, script_t *script, 
-    bool *failptr) {
+static void *eval_realloc(request_t *request, script_t *script, bool *failptr) {
 
-    int id = script->ops[req].id;
+    int id = request->id;
+    size_t requested_size = request->size;
     size_t old_size = script->blocks[id].size;
 
     void *oldp = script->blocks[id].ptr;
     if (!verify_payload(oldp, old_size, id, script, 
-        script->ops[req].lineno, "pre-realloc-ing")) {
+        request->lineno, "pre-realloc-ing")) {
         *failptr = true;
         return NULL;
     }
 
     void *newp;
     if ((newp = myrealloc(oldp, requested_size)) == NULL && requested_size != 0) {
-        allocator_error(script, script->ops[req].lineno, 
+        allocator_error(script, request->lineno, 
             "heap exhausted, realloc returned NULL");
         *failptr = true;
         return NULL;
     }
 
-    script->blocks[id].size = 0;
-    if (!verify_block(newp, requested_size, script, script->ops[req].lineno)) {
+    set_block(script, id, oldp, 0);
+    if (!verify_block(newp, requested_size, script, request->lineno)) {
         *failptr = true;
         return NULL;
     }
 
     // Verify new block contains the data from the old block
     if (!verify_payload(newp, (old_size < requested_size ? old_size : requested_size), 
-        id, script, script->ops[req].lineno, "post-realloc-ing (preserving data)")) {
+        id, script, request->lineno, "post-realloc-ing (preserving data)")) {
         *failptr = true;
         return NULL;
     }
 
     // Fill new block with the low-order byte of new id
     memset(newp, id & 0xFF, requested_size);
-    script->blocks[id] = (block_t){.ptr = newp, .size = requested_size};
+    set_block(script, id, newp, requested_size);
 
     *failptr = false;
     return newp;
 }
 
 
+/* Function: set_block
+ * --------------------
+ * Records that block id now has the given address and size, keeping the
+ * address index in step.  Only blocks with an address and a nonzero size
+ * are in the index, so it holds exactly the blocks that can be overlapped.
+ */
+static void set_block(script_t *script, int id, void *ptr, size_t size) {
+    if (script->blocks[id].ptr != NULL && script->blocks[id].size > 0) {
+        index_remove(script, id);
+    }
+    script->blocks[id].ptr = ptr;
+    script->blocks[id].size = size;
+    if (ptr != NULL && size > 0) {
+        index_insert(script, id);
+    }
+}
+
+/* Function: index_priority
+ * ------------------------
+ * The address index is a treap of live blocks ordered by address, and the
+ * heap priority of a block is a hash of its id.
+ */
+static uint64_t index_priority(int id) {
+    return (uint64_t)(id + 1) * 0x9E3779B97F4A7C15UL;
+}
+
+/* Function: index_insert
+ * ----------------------
+ * Inserts block id into the address index.  Walks down until the block's
+ * priority beats the subtree's root, then splits that subtree around the
+ * block's address into its left and right children.
+ */
+static void index_insert(script_t *script, int id) {
+    block_t *blocks = script->blocks;
+    void *key = blocks[id].ptr;
+    uint64_t priority = index_priority(id);
+    int *link = &script->index_root;
+    while (*link >= 0 && index_priority(*link) > priority) {
+        link = key < blocks[*link].ptr ? &blocks[*link].left : &blocks[*link].right;
+    }
+
+    int cur = *link;
+    int *left = &blocks[id].left;
+    int *right = &blocks[id].right;
+    while (cur >= 0) {
+        if (key < blocks[cur].ptr) {
+            *right = cur;
+            right = &blocks[cur].left;
+            cur = blocks[cur].left;
+        } else {
+            *left = cur;
+            left = &blocks[cur].right;
+            cur = blocks[cur].right;
+        }
+    }
+    *left = -1;
+    *right = -1;
+    *link = id;
+}
+
+/* Function: index_remove
+ * ----------------------
+ * Removes block id from the address index.  Finds the link to it, rotates
+ * it down until it has at most one child and then splices it out.
+ */
+static void index_remove(script_t *script, int id) {
+    block_t *blocks = script->blocks;
+    void *key = blocks[id].ptr;
+    int *link = &script->index_root;
+    while (*link != id) {
+        link = key < blocks[*link].ptr ? &blocks[*link].left : &blocks[*link].right;
+    }
+
+    while (blocks[id].left >= 0 && blocks[id].right >= 0) {
+        int child;
+        if (index_priority(blocks[id].left) > index_priority(blocks[id].right)) {
+            child = blocks[id].left;
+            blocks[id].left = blocks[child].right;
+            blocks[child].right = id;
+            *link = child;
+            link = &blocks[child].right;
+        } else {
+            child = blocks[id].right;
+            blocks[id].right = blocks[child].left;
+            blocks[child].left = id;
+            *link = child;
+            link = &blocks[child].left;
+        }
+    }
+    *link = blocks[id].left >= 0 ? blocks[id].left : blocks[id].right;
+}
+
 /* Function: verify_block
  * ----------------------
  * Does some checks on the block returned by allocator to try to
  * verify correctness.  If any problem shows up, reports an allocator error
  * with details and line from script file. The checks it performs are:
  *  -- verify block address is correctly aligned
- *  -- verify block address is within heap segment
- *  -- verify block address + size doesn't overlap any existing allocated block
+ *  -- verify block address is within heap segment, or within a mapping
+ *     the allocator made for a huge block
+ *  -- verify block address + size doesn't overlap any existing allocated block,
+ *     looking up its neighbours in the address index of live blocks
  */
 static bool verify_block(void *ptr, size_t size, script_t *script, int lineno) {
     // address must be ALIGNMENT-byte aligned
@@ -359,22 +674,34 @@ static bool verify_block(void *ptr, size_t size, script_t *script, int lineno) {
     // block must lie within the extent of the heap
     void *end = (char *)ptr + size;
     void *heap_end = (char *)heap_segment_start() + heap_segment_size();
-    if (ptr < heap_segment_start() || end > heap_end) {
+    if ((ptr < heap_segment_start() || end > heap_end) && !in_huge_segment(ptr, size)) {
         allocator_error(script, lineno, "New block (%p:%p) not within heap segment (%p:%p)",
                         ptr, end, heap_segment_start(), heap_end);
         return false;
     }
 
-    // block must not overlap any other blocks
-    for (int i = 0; i < script->num_ids; i++) {
-        if (script->blocks[i].ptr == NULL || script->blocks[i].size == 0) {
+    // block must not overlap any other blocks, and since the live blocks
+    // don't overlap each other, only the ones starting closest at or below
+    // it and closest above it can
+    int below = -1;
+    int above = -1;
+    for (int cur = script->index_root; cur >= 0; ) {
+        if (script->blocks[cur].ptr <= ptr) {
+            below = cur;
+            cur = script->blocks[cur].right;
+        } else {
+            above = cur;
+            cur = script->blocks[cur].left;
+        }
+    }
+    int neighbors[2] = {below, above};
+    for (int i = 0; i < 2; i++) {
+        if (neighbors[i] < 0) {
             continue;
         }
-
-        void *other_start = script->blocks[i].ptr;
-        void *other_end = (char *)other_start + script->blocks[i].size;
-        if ((ptr >= other_start && ptr < other_end) || (end > other_start && end < other_end) ||
-            (ptr < other_start && end >= other_end)) {
+        void *other_start = script->blocks[neighbors[i]].ptr;
+        void *other_end = (char *)other_start + script->blocks[neighbors[i]].size;
+        if ((ptr >= other_start && ptr < other_end) || (ptr < other_start && end > other_start)) {
             allocator_error(script, lineno, "New block (%p:%p) overlaps existing block (%p:%p)",
                             ptr, end, other_start, other_end);
             return false;
@@ -420,9 +747,241 @@ static void allocator_error(script_t *script, int lineno, char* format, ...) {
 }
 
 
+/* PERFORMANCE EVALUATION IMPLEMENTATION */
+
+
+/* Function: bench_scripts
+ * -----------------------
+ * Runs the scripts with names in the specified array in benchmark mode and
+ * prints the throughput and latency percentiles of each request type.  If
+ * `json` is not NULL, the same results are written to it as one JSON object
+ * tagged with the allocator name.  Returns the number of failed scripts.
+ */
+static int bench_scripts(char *script_names[], int num_script_names,
+    const char *allocator_name, FILE *json) {
+    int nfailures = 0;
+
+    if (json != NULL) {
+        fprintf(json, "{\"allocator\": ");
+        write_json_string(json, allocator_name);
+        fprintf(json, ", \"scripts\": [");
+    }
+    for (int i = 0; i < num_script_names; i++) {
+        script_t script = load_script(script_names[i]);
+
+        printf("\nBenchmarking allocator on %s...", script.name);
+        latency_t stats[NUM_REQUEST_TYPES];
+        double seconds;
+        if (eval_performance(&script, stats, &seconds)) {
+            printf("%d requests in %.3f ms (%.0f ops/sec)\n", script.num_ops,
+                seconds * 1e3, script.num_ops / seconds);
+            printf("  %-8s %10s %14s %10s %8s %8s %8s\n", "request", "count",
+                "ops/sec", "mean ns", "p50", "p99", "p99.9");
+            for (int t = 0; t < NUM_REQUEST_TYPES; t++) {
+                printf("  %-8s %10d %14.0f %10.1f %8lu %8lu %8lu\n", REQUEST_NAMES[t],
+                    stats[t].count, stats[t].ops_per_sec, stats[t].mean_ns,
+                    stats[t].p50_ns, stats[t].p99_ns, stats[t].p999_ns);
+            }
+            if (json != NULL) {
+                fprintf(json, "%s\n  {\"script\": ", i > 0 ? "," : "");
+                write_json_string(json, script.name);
+                fprintf(json, ", \"requests\": %d, \"seconds\": %.9f, \"ops_per_sec\": %.0f",
+                    script.num_ops, seconds, script.num_ops / seconds);
+                for (int t = 0; t < NUM_REQUEST_TYPES; t++) {
+                    fprintf(json, ", \"%s\": {\"count\": %d, \"ops_per_sec\": %.0f, "
+                        "\"mean_ns\": %.1f, \"p50_ns\": %lu, \"p99_ns\": %lu, \"p999_ns\": %lu}",
+                        REQUEST_NAMES[t], stats[t].count, stats[t].ops_per_sec,
+                        stats[t].mean_ns, stats[t].p50_ns, stats[t].p99_ns, stats[t].p999_ns);
+                }
+                fprintf(json, "}");
+            }
+        } else {
+            nfailures++;
+        }
+
+        free_script(&script);
+    }
+    if (json != NULL) {
+        fprintf(json, "\n]}\n");
+    }
+    return nfailures;
+}
+
+/* Function: write_json_string
+ * ---------------------------
+ * Writes the string to `json` as a quoted JSON string, escaping quotes,
+ * backslashes and control characters, which can all appear in file names.
+ */
+static void write_json_string(FILE *json, const char *str) {
+    fputc('"', json);
+    for (const unsigned char *p = (const unsigned char *)str; *p != '\0'; p++) {
+        if (*p == '"' || *p == '\\') {
+            fprintf(json, "\\%c", *p);
+        } else if (*p < 0x20) {
+            fprintf(json, "\\u%04x", *p);
+        } else {
+            fputc(*p, json);
+        }
+    }
+    fputc('"', json);
+}
+
+/* Function: eval_performance
+ * --------------------------
+ * Replays the given script and times each request on its own, without
+ * validating the heap, checking blocks or touching payloads, so that only
+ * the allocator is measured.  The cost of reading the clock is measured
+ * up front and taken off every sample.  Fills in the latency results for
+ * each request type and the total time of the replay in seconds, and
+ * returns false if the allocator failed to initialize or ran out of memory.
+ */
+static bool eval_performance(script_t *script, latency_t stats[], double *pseconds) {
+    init_heap_segment(HEAP_SIZE);
+    if (!myinit(heap_segment_start(), heap_segment_size())) {
+        allocator_error(script, 0, "myinit() returned false");
+        return false;
+    }
+
+    // The clock overhead is the smallest difference between two readings
+    uint64_t overhead = UINT64_MAX;
+    for (int i = 0; i < 1000; i++) {
+        uint64_t before = time_ns();
+        uint64_t after = time_ns();
+        if (after - before < overhead) {
+            overhead = after - before;
+        }
+    }
+
+    // One array of samples per request type, sized by the counts from loading
+    int counts[NUM_REQUEST_TYPES];
+    uint64_t *samples[NUM_REQUEST_TYPES];
+    for (int t = 0; t < NUM_REQUEST_TYPES; t++) {
+        samples[t] = malloc((script->counts[t] > 0 ? script->counts[t] : 1) * sizeof(uint64_t));
+        if (samples[t] == NULL) {
+            error(1, 0, "Libc heap exhausted. Cannot continue.");
+        }
+        counts[t] = 0;
+    }
+
+    bool success = true;
+    rewind_script(script);
+    uint64_t start = time_ns();
+    for (int req = 0; req < script->num_ops && success; req++) {
+        request_t request = next_request(script, req);
+        int id = request.id;
+        size_t requested_size = request.size;
+        int t = request.op - ALLOC;
+
+        uint64_t before = time_ns();
+        if (request.op == ALLOC) {
+            void *p = mymalloc(requested_size);
+            samples[t][counts[t]] = time_ns() - before;
+            success = p != NULL || requested_size == 0;
+            script->blocks[id] = (block_t){.ptr = p, .size = requested_size};
+        } else if (request.op == REALLOC) {
+            void *p = myrealloc(script->blocks[id].ptr, requested_size);
+            samples[t][counts[t]] = time_ns() - before;
+            success = p != NULL || requested_size == 0;
+            script->blocks[id] = (block_t){.ptr = p, .size = requested_size};
+        } else {
+            myfree(script->blocks[id].ptr);
+            samples[t][counts[t]] = time_ns() - before;
+            script->blocks[id] = (block_t){.ptr = NULL, .size = 0};
+        }
+        samples[t][counts[t]] = samples[t][counts[t]] > overhead ? samples[t][counts[t]] - overhead : 0;
+        counts[t]++;
+        if (!success) {
+            allocator_error(script, request.lineno, "heap exhausted, %s returned NULL",
+                REQUEST_NAMES[t]);
+        }
+    }
+    *pseconds = (time_ns() - start) / 1e9;
+
+    for (int t = 0; t < NUM_REQUEST_TYPES; t++) {
+        summarize_latencies(samples[t], counts[t], &stats[t]);
+        free(samples[t]);
+    }
+    return success;
+}
+
+/* Function: time_ns
+ * -----------------
+ * Returns the time of a monotonic clock in nanoseconds.
+ */
+static uint64_t time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Function: compare_samples
+ * -------------------------
+ * qsort comparison function for latency samples.
+ */
+static int compare_samples(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Function: summarize_latencies
+ * -----------------------------
+ * Sorts the given latency samples and fills in their count, throughput,
+ * mean and percentiles.  All fields are zero if there are no samples.
+ */
+static void summarize_latencies(uint64_t samples[], int count, latency_t *stats) {
+    *stats = (latency_t){.count = count};
+    if (count == 0) {
+        return;
+    }
+    qsort(samples, count, sizeof(uint64_t), compare_samples);
+    uint64_t total = 0;
+    for (int i = 0; i < count; i++) {
+        total += samples[i];
+    }
+    stats->mean_ns = (double)total / count;
+    stats->ops_per_sec = total > 0 ? count / (total / 1e9) : 0;
+    stats->p50_ns = samples[(count - 1) * 50L / 100];
+    stats->p99_ns = samples[(count - 1) * 99L / 100];
+    stats->p999_ns = samples[(count - 1) * 999L / 1000];
+}
+
+
 /* SCRIPT PARSING IMPLEMENTATION */
 
 
+/* Function: load_script
+ * ---------------------
+ * Loads the script or trace at the specified path, telling the two apart by
+ * the magic bytes at the start of a trace.  This function throws an error if
+ * the file can't be opened.
+ */
+static script_t load_script(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        error(1, 0, "Could not open script file \"%s\".", path);
+    }
+    char magic[TRACE_MAGIC_LEN];
+    if (read(fd, magic, sizeof(magic)) == sizeof(magic)
+        && memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0) {
+        script_t script = map_trace(path, fd);
+        close(fd);
+        return script;
+    }
+    close(fd);
+    return parse_script(path);
+}
+
+/* Function: set_script_name
+ * -------------------------
+ * Stores the last component of the path as the short name of the script.
+ */
+static void set_script_name(script_t *script, const char *path) {
+    const char *basename = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    strncpy(script->name, basename, sizeof(script->name) - 1);
+    script->name[sizeof(script->name) - 1] = '\0';
+}
+
 /* Fuction: parse_script
  * ---------------------
  * This function parses the script file at the specified path, and returns an
@@ -439,9 +998,7 @@ static script_t parse_script(const char *path) {
 
     // Initialize a script object to store the information about this script
     script_t script = { .ops = NULL, .blocks = NULL, .num_ops = 0, .peak_size = 0};
-    const char *basename = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
-    strncpy(script.name, basename, sizeof(script.name) - 1);
-    script.name[sizeof(script.name) - 1] = '\0';
+    set_script_name(&script, path);
 
     int lineno = 0;
     int nallocated = 0;
@@ -450,9 +1007,10 @@ static script_t parse_script(const char *path) {
 
     for (int i = 0; read_line(buffer, sizeof(buffer), fp, &lineno); i++) {
 
-        // Resize script->ops if we need more space for lines
+        // Resize script->ops if we need more space for lines, doubling it so
+        // that long scripts aren't copied over and over
         if (i == nallocated) {
-            nallocated += OPS_RESIZE_AMOUNT;
+            nallocated = nallocated == 0 ? OPS_INITIAL_CAPACITY : 2 * nallocated;
             void *new_memory = realloc(script.ops, 
                 nallocated * sizeof(request_t));
             if (!new_memory) {
@@ -463,6 +1021,7 @@ static script_t parse_script(const char *path) {
         }
 
         script.ops[i] = parse_script_line(buffer, i, lineno, script.name);
+        script.counts[script.ops[i].op - ALLOC]++;
 
         if (script.ops[i].id > maxid) {
             maxid = script.ops[i].id;
@@ -482,6 +1041,111 @@ static script_t parse_script(const char *path) {
     return script;
 }
 
+/* Function: map_trace
+ * --------------------
+ * This function maps the binary trace open as fd into memory read-only and
+ * returns an object with info about it, taking the request counts and
+ * number of block ids from the trace header.  The records themselves are
+ * not looked at until they are replayed.  This function throws an error if
+ * the trace can't be mapped or its header is malformed.
+ */
+static script_t map_trace(const char *path, int fd) {
+    script_t script = { .ops = NULL, .blocks = NULL, .num_ops = 0, .peak_size = 0};
+    set_script_name(&script, path);
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(trace_header_t)) {
+        error(1, 0, "Trace file '%s' is truncated.", script.name);
+    }
+    script.trace_len = st.st_size;
+    void *map = mmap(NULL, script.trace_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        error(1, errno, "Could not map trace file '%s'", script.name);
+    }
+    // records are read once from start to end
+    madvise(map, script.trace_len, MADV_SEQUENTIAL);
+    script.trace = map;
+
+    const trace_header_t *header = map;
+    uint64_t total = 0;
+    for (int t = 0; t < NUM_REQUEST_TYPES; t++) {
+        if (header->counts[t] > INT_MAX) {
+            error(1, 0, "Trace file '%s' has too many requests.", script.name);
+        }
+        script.counts[t] = header->counts[t];
+        total += header->counts[t];
+    }
+    if (header->num_ops != total || total > INT_MAX || header->num_ids > INT_MAX) {
+        error(1, 0, "Trace file '%s' has a malformed header.", script.name);
+    }
+    script.num_ops = total;
+    script.num_ids = header->num_ids > 0 ? header->num_ids : 1;
+
+    script.blocks = calloc(script.num_ids, sizeof(block_t));
+    if (!script.blocks) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+
+    return script;
+}
+
+/* Function: rewind_script
+ * -----------------------
+ * Gets the script ready to replay its requests from the first one.
+ */
+static void rewind_script(script_t *script) {
+    if (script->trace != NULL) {
+        script->cursor = script->trace + sizeof(trace_header_t);
+        script->prev_id = 0;
+    }
+}
+
+/* Function: next_request
+ * ----------------------
+ * Returns request number req of the script, which for a trace must be the
+ * one after the last request returned.  Trace records are decoded here, and
+ * this function throws an error if a record is malformed or runs past the
+ * end of the trace.
+ */
+static request_t next_request(script_t *script, int req) {
+    if (script->trace == NULL) {
+        return script->ops[req];
+    }
+
+    const uint8_t *end = script->trace + script->trace_len;
+    request_t request = { .lineno = req + 1, .op = 0, .size = 0};
+    uint64_t zigzag, size = 0;
+    if (script->cursor < end) {
+        request.op = *script->cursor++;
+    }
+    if (request.op < ALLOC || request.op > REALLOC
+        || !trace_get_varint(&script->cursor, end, &zigzag)
+        || (request.op != FREE && !trace_get_varint(&script->cursor, end, &size))) {
+        error(1, 0, "Request %d of trace file '%s' is malformed.", req + 1, script->name);
+    }
+
+    int64_t id = script->prev_id + (int64_t)((zigzag >> 1) ^ -(zigzag & 1));
+    if (id < 0 || id >= script->num_ids || size > MAX_REQUEST_SIZE) {
+        error(1, 0, "Request %d of trace file '%s' is malformed.", req + 1, script->name);
+    }
+    request.id = script->prev_id = id;
+    request.size = size;
+    return request;
+}
+
+/* Function: free_script
+ * ---------------------
+ * Releases the requests and blocks of the script, unmapping it if it is
+ * a trace.
+ */
+static void free_script(script_t *script) {
+    free(script->ops);
+    free(script->blocks);
+    if (script->trace != NULL) {
+        munmap((void *)script->trace, script->trace_len);
+    }
+}
+
 /* Function: read_line
  * --------------------
  * This function reads one line from the specified file and stores at most
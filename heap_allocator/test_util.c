@@ -0,0 +1,36 @@
+/* File: test_util.c
+ * -----------------
+ * Fixture shared by the test drivers, see test_util.h.
+ */
+
+#include <error.h>
+#include <stdio.h>
+#include "allocator.h"
+#include "segment.h"
+#include "test_util.h"
+
+const long HEAP_SIZE = 1L << 32;
+
+int nfailures;
+
+bool check(bool ok, const char *what) {
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        nfailures++;
+    }
+    return ok;
+}
+
+void reset_heap(void) {
+    init_heap_segment(HEAP_SIZE);
+    if (!myinit(heap_segment_start(), heap_segment_size())) {
+        error(1, 0, "myinit() returned false");
+    }
+}
+
+uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
@@ -0,0 +1,40 @@
+/* File: test_util.h
+ * -----------------
+ * Fixture shared by the test drivers (api_test.c, batch_test.c,
+ * arena_test.c) and thread_stress.c: a fresh heap for each case, a count
+ * of failed checks and a random generator that gives the same runs on
+ * every machine.
+ */
+
+#ifndef _TEST_UTIL_H_
+#define _TEST_UTIL_H_
+#include <stdbool.h>  // for bool
+#include <stdint.h>   // for uint64_t
+
+// reserved size of the heap segment that reset_heap sets up
+extern const long HEAP_SIZE;
+
+// number of failed checks so far, which a driver returns from main
+extern int nfailures;
+
+/* Function: check
+ * ---------------
+ * Counts and reports a failed check, along with what was being tested.
+ * Returns ok.
+ */
+bool check(bool ok, const char *what);
+
+/* Function: reset_heap
+ * --------------------
+ * Gives the allocator a fresh, empty heap, exiting if myinit fails.
+ */
+void reset_heap(void);
+
+/* Function: next_random
+ * ---------------------
+ * Small xorshift generator on the given state, which must not be 0.
+ * Each thread can keep a state of its own, so none contend on rand().
+ */
+uint64_t next_random(uint64_t *state);
+
+#endif
@@ -0,0 +1,244 @@
+/* File: thread_stress.c
+ * ---------------------
+ * Stress and throughput driver for a thread-safe heap allocator. For
+ * 1, 2, 4, ... up to N threads, every thread runs the same randomized
+ * mix of mymalloc, myrealloc and myfree calls on its own set of slots,
+ * tagging each block so that overlapping or corrupted blocks are caught.
+ * After each round the heap is validated and the aggregate throughput
+ * is reported in operations per second. Before the rounds, one block of
+ * every size the thread caches serve is freed to check that it stays in
+ * the cache.
+ *
+ * Usage: thread_stress [-t max_threads] [-n ops_per_thread] [-s slots]
+ */
+
+#include <error.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "allocator.h"
+#include "test_util.h"
+
+// largest request the threaded allocator serves from its thread caches
+#define CACHED_MAX_SIZE 512
+
+// struct for one live block owned by a thread
+typedef struct {
+    unsigned char *ptr;
+    size_t size;
+} slot_t;
+
+// struct for the work and results of one thread
+typedef struct {
+    int index;          // thread number, used in the block tags
+    long num_ops;       // requests to make
+    int num_slots;      // blocks that may be live at once
+    bool failed;        // set if a block was corrupted or malloc failed
+} worker_t;
+
+/* Function: random_size
+ * ---------------------
+ * Mostly small sizes, some medium ones and the occasional large block.
+ */
+static size_t random_size(uint64_t *state) {
+    uint64_t r = next_random(state);
+    int bucket = r % 100;
+    r >>= 8;
+    if (bucket < 90) {
+        return 1 + r % 256;
+    } else if (bucket < 99) {
+        return 257 + r % 3840;
+    } else {
+        return 4097 + r % 61440;
+    }
+}
+
+/* Function: tag_of
+ * ----------------
+ * Byte written at both ends of a block, unique per thread and slot.
+ */
+static unsigned char tag_of(worker_t *w, int slot) {
+    return (w->index * 131 + slot) & 0xFF;
+}
+
+/* Function: check_slot
+ * --------------------
+ * Verifies the tags of a live block, reporting any corruption.
+ */
+static bool check_slot(worker_t *w, slot_t *s, int slot) {
+    unsigned char tag = tag_of(w, slot);
+    if (s->ptr[0] != tag || s->ptr[s->size - 1] != tag) {
+        printf("Thread %d: block %p (%zu bytes) in slot %d was overwritten.\n",
+               w->index, s->ptr, s->size, slot);
+        return false;
+    }
+    return true;
+}
+
+/* Function: run_worker
+ * --------------------
+ * Thread body: fills and empties random slots until num_ops requests
+ * are made, then frees whatever is still live.
+ */
+static void *run_worker(void *arg) {
+    worker_t *w = arg;
+    slot_t *slots = calloc(w->num_slots, sizeof(slot_t));
+    if (slots == NULL) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+    uint64_t state = 0x9E3779B97F4A7C15UL * (w->index + 1);
+
+    for (long op = 0; op < w->num_ops && !w->failed; op++) {
+        int slot = next_random(&state) % w->num_slots;
+        slot_t *s = &slots[slot];
+        if (s->ptr == NULL) {
+            s->size = random_size(&state);
+            s->ptr = mymalloc(s->size);
+            if (s->ptr == NULL) {
+                printf("Thread %d: mymalloc(%zu) returned NULL.\n", w->index, s->size);
+                w->failed = true;
+                break;
+            }
+            s->ptr[0] = s->ptr[s->size - 1] = tag_of(w, slot);
+        } else if (!check_slot(w, s, slot)) {
+            w->failed = true;
+        } else if (next_random(&state) % 5 == 0) {
+            size_t new_size = random_size(&state);
+            unsigned char *new_ptr = myrealloc(s->ptr, new_size);
+            if (new_ptr == NULL) {
+                printf("Thread %d: myrealloc(%zu) returned NULL.\n", w->index, new_size);
+                w->failed = true;
+                break;
+            }
+            s->ptr = new_ptr;
+            s->size = new_size;
+            s->ptr[0] = s->ptr[s->size - 1] = tag_of(w, slot);
+        } else {
+            myfree(s->ptr);
+            s->ptr = NULL;
+        }
+    }
+
+    for (int slot = 0; slot < w->num_slots; slot++) {
+        if (slots[slot].ptr != NULL) {
+            if (!check_slot(w, &slots[slot], slot)) {
+                w->failed = true;
+            }
+            myfree(slots[slot].ptr);
+        }
+    }
+    free(slots);
+    return NULL;
+}
+
+/* Function: run_round
+ * -------------------
+ * Runs num_threads workers on a freshly initialized heap and returns
+ * the elapsed wall-clock seconds, or a negative value on failure.
+ */
+static double run_round(int num_threads, long ops_per_thread, int num_slots) {
+    reset_heap();
+
+    pthread_t threads[num_threads];
+    worker_t workers[num_threads];
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < num_threads; i++) {
+        workers[i] = (worker_t){ .index = i, .num_ops = ops_per_thread,
+                                 .num_slots = num_slots, .failed = false };
+        pthread_create(&threads[i], NULL, run_worker, &workers[i]);
+    }
+    bool failed = false;
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+        failed |= workers[i].failed;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (failed || !validate_heap()) {
+        return -1;
+    }
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/* Function: check_cached_frees
+ * ----------------------------
+ * Allocates and frees a block of every size up to CACHED_MAX_SIZE and
+ * checks through myheap_stats that the shared heap still counts it as
+ * live, i.e. that the free went to the thread's cache instead of taking
+ * the lock. Returns whether every size did and the heap is valid.
+ */
+static bool check_cached_frees(void) {
+    reset_heap();
+    for (size_t size = 1; size <= CACHED_MAX_SIZE; size++) {
+        void *ptr = mymalloc(size);
+        if (ptr == NULL) {
+            printf("mymalloc(%zu) returned NULL.\n", size);
+            return false;
+        }
+        struct heap_stats before, after;
+        myheap_stats(&before);
+        myfree(ptr);
+        myheap_stats(&after);
+        if (after.live_blocks != before.live_blocks) {
+            printf("A freed block of %zu bytes went past the thread cache.\n", size);
+            return false;
+        }
+    }
+    return validate_heap();
+}
+
+int main(int argc, char *argv[]) {
+    int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    long ops_per_thread = 1000000;
+    int num_slots = 1000;
+    int c;
+    while ((c = getopt(argc, argv, "t:n:s:")) != -1) {
+        if (c == 't') {
+            max_threads = atoi(optarg);
+        } else if (c == 'n') {
+            ops_per_thread = atol(optarg);
+        } else if (c == 's') {
+            num_slots = atoi(optarg);
+        } else {
+            error(1, 0, "Usage: %s [-t max_threads] [-n ops_per_thread] [-s slots]", argv[0]);
+        }
+    }
+    if (max_threads < 1 || ops_per_thread < 1 || num_slots < 1) {
+        error(1, 0, "Thread, op and slot counts must be positive.");
+    }
+
+    setvbuf(stdout, NULL, _IONBF, 0);
+    if (!check_cached_frees()) {
+        printf("FAILED the thread cache check\n");
+        return 1;
+    }
+    printf("%8s %14s %16s %8s\n", "threads", "ops/sec", "ops/sec/thread", "speedup");
+    double base_rate = 0;
+    for (int num_threads = 1; ; num_threads *= 2) {
+        if (num_threads > max_threads) {
+            num_threads = max_threads;
+        }
+        double secs = run_round(num_threads, ops_per_thread, num_slots);
+        if (secs < 0) {
+            printf("FAILED with %d threads\n", num_threads);
+            return 1;
+        }
+        double rate = num_threads * ops_per_thread / secs;
+        if (num_threads == 1) {
+            base_rate = rate;
+        }
+        printf("%8d %14.0f %16.0f %7.2fx\n", num_threads, rate, rate / num_threads,
+               rate / base_rate);
+        if (num_threads == max_threads) {
+            break;
+        }
+    }
+    return 0;
+}
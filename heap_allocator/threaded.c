@@ -0,0 +1,376 @@
+/* File: threaded.c
+ * Author: Tiantian Fang
+ *
+ * This file contains my implementation of a thread-safe allocator. It is
+ * a front end over the explicit allocator (see engine.h): the explicit
+ * heap is shared by all threads and protected by one lock, and each
+ * thread keeps a small cache of free blocks per size class in front of
+ * it. Small mallocs and frees are served from the calling thread's cache
+ * without taking the lock; only refilling an empty bin, flushing a full
+ * one and large requests go to the shared heap.
+ *
+ * Cached blocks stay allocated as far as the engine is concerned. A
+ * block freed by one thread may be cached and reused by another, which
+ * is fine since every block comes from the same shared heap. The
+ * helpers here are static because this file is linked together with
+ * the engine, whose own helpers are global.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "allocator.h"
+#include "engine.h"
+
+// size classes are multiples of TCACHE_CLASS_SIZE up to TCACHE_MAX_SIZE
+#define TCACHE_CLASS_SIZE 16
+#define TCACHE_NCLASSES 32
+#define TCACHE_MAX_SIZE (TCACHE_CLASS_SIZE * TCACHE_NCLASSES)
+// the heap rounds payloads up to 4 bytes past a multiple of 8 and leaves
+// tails under 32 bytes on the block, so blocks fetched for the top class
+// have up to this many bytes less 1, and go back to it when freed
+#define TCACHE_MAX_BLOCK (TCACHE_MAX_SIZE + 32)
+
+// most blocks a bin holds before half of them are flushed to the heap
+#define TCACHE_CAPACITY 64
+// number of blocks fetched from the heap at once when a bin is empty
+#define TCACHE_REFILL 16
+
+struct CachedBl
+{
+    struct CachedBl *next;
+};
+
+struct TCache
+{
+    struct CachedBl *bins[TCACHE_NCLASSES];
+    int counts[TCACHE_NCLASSES];
+    unsigned long generation;   // heap generation the cached blocks belong to
+    bool registered;            // whether the exit destructor is installed
+};
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key;
+
+// bumped by myinit so caches filled from an earlier heap are dropped
+static unsigned long heap_generation;
+
+static __thread struct TCache tcache;
+
+/* Function: class_of_request
+ *
+ * Parameters:
+ * size - requested size, at most TCACHE_MAX_SIZE
+ *
+ * Returns:
+ * the smallest size class that can hold the request
+ */
+static int class_of_request(size_t size) {
+    return (size - 1) / TCACHE_CLASS_SIZE;
+}
+
+/* Function: class_size
+ *
+ * Parameters:
+ * class - a size class
+ *
+ * Returns:
+ * the number of bytes every block in the class can hold
+ */
+static size_t class_size(int class) {
+    return (size_t)(class + 1) * TCACHE_CLASS_SIZE;
+}
+
+/* Function: usable_size
+ *
+ * Parameters:
+ * ptr - pointer to the payload of an allocated block
+ *
+ * Returns:
+ * the payload size of the block in the shared heap
+ */
+static size_t usable_size(void *ptr) {
+    return get_pl_size(hdptr_of(ptr));
+}
+
+/* Function: flush_bin
+ *
+ * Parameters:
+ * tc - the calling thread's cache
+ * class - size class of the bin
+ * nblocks - how many blocks to give back
+ *
+ * This function hands cached blocks back to the shared heap, taking
+ * the lock once for the whole batch.
+ */
+static void flush_bin(struct TCache *tc, int class, int nblocks) {
+    pthread_mutex_lock(&heap_lock);
+    while (nblocks-- > 0 && tc->bins[class] != NULL) {
+        struct CachedBl *cur = tc->bins[class];
+        tc->bins[class] = cur->next;
+        tc->counts[class]--;
+        engine_free(cur);
+    }
+    pthread_mutex_unlock(&heap_lock);
+}
+
+/* Function: release_tcache
+ *
+ * Parameters:
+ * arg - the exiting thread's cache
+ *
+ * This function runs when a thread exits and gives all of its cached
+ * blocks back to the shared heap.
+ */
+static void release_tcache(void *arg) {
+    struct TCache *tc = arg;
+    if (tc->generation != heap_generation) {
+        return;
+    }
+    for (int class = 0; class < TCACHE_NCLASSES; class++) {
+        flush_bin(tc, class, tc->counts[class]);
+    }
+}
+
+/* Function: create_tcache_key
+ *
+ * This function creates the key whose destructor flushes a thread's
+ * cache when the thread exits.
+ */
+static void create_tcache_key(void) {
+    pthread_key_create(&tcache_key, release_tcache);
+}
+
+/* Function: get_tcache
+ *
+ * Returns:
+ * the calling thread's cache, emptied if it belongs to an earlier heap
+ */
+static struct TCache *get_tcache(void) {
+    struct TCache *tc = &tcache;
+    if (!tc->registered) {
+        pthread_once(&key_once, create_tcache_key);
+        pthread_setspecific(tcache_key, tc);
+        tc->registered = true;
+    }
+    if (tc->generation != heap_generation) {
+        memset(tc->bins, 0, sizeof(tc->bins));
+        memset(tc->counts, 0, sizeof(tc->counts));
+        tc->generation = heap_generation;
+    }
+    return tc;
+}
+
+/* Function: myinit
+ *
+ * Parameters:
+ * heap_start - pointer to the start of heap
+ * heap_size - size of heap
+ *
+ * Returns:
+ * if the initialization was successful
+ *
+ * This function resets the shared heap. Blocks cached by any thread
+ * belonged to the old heap, so every cache is dropped.
+ */
+bool myinit(void *heap_start, size_t heap_size) {
+    pthread_mutex_lock(&heap_lock);
+    heap_generation++;
+    bool success = engine_init(heap_start, heap_size);
+    pthread_mutex_unlock(&heap_lock);
+    return success;
+}
+
+/* Function: mymalloc
+ *
+ * Parameters:
+ * requested_size - requested size to be allocated
+ *
+ * Returns:
+ * pointer to the payload of the block that the requested size can fit in
+ *
+ * This function pops a block from the calling thread's cache for small
+ * requests, refilling the bin from the shared heap when it is empty.
+ * Large requests go straight to the shared heap.
+ */
+void *mymalloc(size_t requested_size) {
+    if (requested_size == 0 || requested_size > MAX_REQUEST_SIZE) {
+        return NULL;
+    }
+    if (requested_size > TCACHE_MAX_SIZE) {
+        pthread_mutex_lock(&heap_lock);
+        void *ptr = engine_malloc(requested_size);
+        pthread_mutex_unlock(&heap_lock);
+        return ptr;
+    }
+
+    struct TCache *tc = get_tcache();
+    int class = class_of_request(requested_size);
+    if (tc->bins[class] == NULL) {
+        pthread_mutex_lock(&heap_lock);
+        for (int i = 0; i < TCACHE_REFILL; i++) {
+            struct CachedBl *cur = engine_malloc(class_size(class));
+            if (cur == NULL) {
+                break;
+            }
+            cur->next = tc->bins[class];
+            tc->bins[class] = cur;
+            tc->counts[class]++;
+        }
+        pthread_mutex_unlock(&heap_lock);
+        if (tc->bins[class] == NULL) {
+            return NULL;
+        }
+    }
+
+    struct CachedBl *cur = tc->bins[class];
+    tc->bins[class] = cur->next;
+    tc->counts[class]--;
+    return cur;
+}
+
+/* Function: myfree
+ *
+ * Parameters:
+ * ptr - pointer to the payload to be freed
+ *
+ * This function pushes a small block on the calling thread's cache,
+ * flushing half of the bin first if it is full. Blocks a little over
+ * TCACHE_MAX_SIZE, which the top class gets from the heap, go in that
+ * class. Large blocks, and blocks too small for any class, are freed in
+ * the shared heap right away.
+ */
+void myfree(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    size_t pl_size = usable_size(ptr);
+    if (pl_size >= TCACHE_MAX_BLOCK || pl_size < TCACHE_CLASS_SIZE) {
+        pthread_mutex_lock(&heap_lock);
+        engine_free(ptr);
+        pthread_mutex_unlock(&heap_lock);
+        return;
+    }
+
+    struct TCache *tc = get_tcache();
+    //a block goes in the largest class it can fully hold
+    int class = (pl_size < TCACHE_MAX_SIZE ? pl_size : TCACHE_MAX_SIZE) / TCACHE_CLASS_SIZE - 1;
+    if (tc->counts[class] >= TCACHE_CAPACITY) {
+        flush_bin(tc, class, TCACHE_CAPACITY / 2);
+    }
+    struct CachedBl *cur = ptr;
+    cur->next = tc->bins[class];
+    tc->bins[class] = cur;
+    tc->counts[class]++;
+}
+
+/* Function: myrealloc
+ *
+ * Parameters:
+ * old_ptr - pointer to the payload to be reallocated
+ * new_size - the new size requested
+ *
+ * This function reallocates a previously allocated block. A small block
+ * that is big enough is kept as is, blocks in the large range are
+ * resized by the shared heap (in place when it can), and anything else
+ * moves to a new block.
+ */
+void *myrealloc(void *old_ptr, size_t new_size) {
+    if (old_ptr == NULL) {
+        return mymalloc(new_size);
+    }
+    else if (new_size == 0) {
+        myfree(old_ptr);
+        return NULL;
+    }
+    else if (new_size > MAX_REQUEST_SIZE) {
+        return NULL;
+    }
+
+    size_t old_size = usable_size(old_ptr);
+    if (old_size > TCACHE_MAX_SIZE) {
+        pthread_mutex_lock(&heap_lock);
+        void *new_ptr = engine_realloc(old_ptr, new_size);
+        pthread_mutex_unlock(&heap_lock);
+        return new_ptr;
+    }
+    if (new_size <= old_size) {
+        return old_ptr;
+    }
+
+    void *new_ptr = mymalloc(new_size);
+    if (new_ptr != NULL) {
+        memcpy(new_ptr, old_ptr, old_size);
+        myfree(old_ptr);
+    }
+    return new_ptr;
+}
+
+/* Function: mytrim
+ *
+ * Returns: 
+ * number of bytes given back to the OS
+ *
+ * This function trims the shared heap. Blocks sitting in thread caches
+ * are allocated as far as the engine knows, so they keep their pages.
+ */
+size_t mytrim() {
+    pthread_mutex_lock(&heap_lock);
+    size_t released = engine_trim();
+    pthread_mutex_unlock(&heap_lock);
+    return released;
+}
+
+/* Function: myheap_stats
+ *
+ * Parameters:
+ * stats - where to store the snapshot
+ *
+ * This function reports the shared heap's snapshot. Blocks sitting in
+ * thread caches count as live, since the engine handed them out.
+ */
+void myheap_stats(struct heap_stats *stats) {
+    pthread_mutex_lock(&heap_lock);
+    engine_heap_stats(stats);
+    pthread_mutex_unlock(&heap_lock);
+}
+
+/* Function: validate_heap
+ *
+ * Return true if all is ok, or false otherwise.
+ * This function is called periodically by the test
+ * harness to check the state of the heap allocator.
+ * It checks the shared heap, then checks that every block in the
+ * calling thread's cache is big enough for its class (a refill may hand
+ * out a block a little bigger than the largest class) and that the bin
+ * counts are right. Other threads' caches can't be inspected safely.
+ */
+bool validate_heap() {
+    pthread_mutex_lock(&heap_lock);
+    bool heap_ok = engine_validate_heap();
+    pthread_mutex_unlock(&heap_lock);
+    if (!heap_ok) {
+        return false;
+    }
+
+    struct TCache *tc = get_tcache();
+    for (int class = 0; class < TCACHE_NCLASSES; class++) {
+        int count = 0;
+        for (struct CachedBl *cur = tc->bins[class]; cur != NULL; cur = cur->next) {
+            size_t pl_size = usable_size(cur);
+            if (pl_size < class_size(class)) {
+                printf("Cached block at address %p doesn't belong in class %d.\n", cur, class);
+                return false;
+            }
+            count++;
+        }
+        if (count != tc->counts[class] || count > TCACHE_CAPACITY) {
+            printf("Cache bin %d holds %d blocks but counts %d.\n", class, count, tc->counts[class]);
+            return false;
+        }
+    }
+    return true;
+}
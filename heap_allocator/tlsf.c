@@ -0,0 +1,797 @@
+/* File: tlsf.c
+ * Author: Tiantian Fang
+ *
+ * This file contains my implementation of a two-level segregated fit
+ * (TLSF) allocator. Free blocks are kept in size-class bins indexed by
+ * a first level (power of two) and a second level (linear subdivision
+ * of that power of two). A first-level bitmap records which first-level
+ * classes have any free block and a second-level bitmap per first-level
+ * class records which of its bins are non-empty, so finding a block is
+ * a couple of find-first-set operations instead of a list walk.
+ *
+ * Every block has a one-word header holding the payload size, with
+ * bit 0 set if the block is allocated and bit 1 set if the block just
+ * before it in the heap is free. Free blocks keep their prev/next bin
+ * links at the start of the payload and a copy of their payload size
+ * (a footer) in the last word of the payload, so a block being freed
+ * can find and merge with its left neighbour in constant time. The heap
+ * ends with a zero-size allocated sentinel header so that merging with
+ * the right neighbour never needs a bounds check.
+ *
+ * The heap grows at its end through extend_heap_segment whenever no bin
+ * has a block that fits; the old sentinel becomes the header of the new
+ * free block, or the new memory is merged into a free last block.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+#include "allocator.h"
+#include "segment.h"
+#include "debug_break.h"
+
+#define ALLOC_BIT 1
+#define PREV_FREE_BIT 2
+#define FLAG_BITS (ALLOC_BIT | PREV_FREE_BIT)
+
+// number of second-level bins per first-level class, as a power of two
+#define SL_INDEX_LOG2 4
+#define SL_INDEX_COUNT (1 << SL_INDEX_LOG2)
+
+// sizes below SMALL_BLOCK_SIZE all live in first-level class 0
+#define FL_INDEX_SHIFT (SL_INDEX_LOG2 + 3)
+#define SMALL_BLOCK_SIZE (1UL << FL_INDEX_SHIFT)
+
+// largest first-level class, enough for a free block spanning 16 GiB
+#define FL_INDEX_MAX 34
+#define FL_INDEX_COUNT (FL_INDEX_MAX - FL_INDEX_SHIFT + 1)
+
+struct FreeBl
+{
+    struct FreeBl *prev;
+    struct FreeBl *next;
+};
+
+// a free block holds its links plus a footer
+#define MIN_PL_SIZE (sizeof(struct FreeBl) + sizeof(size_t))
+
+// the heap grows by at least this many bytes at a time
+#define HEAP_EXTEND_MIN (64 * 1024)
+
+#define PAGE_SIZE 4096
+// free blocks with at least this payload size get their pages released,
+// a power of two so that it starts a first-level class
+#define TRIM_MIN_SIZE (64 * 1024)
+
+static void *first_hd;
+static void *sentinel_hd;
+static size_t total_size;
+
+static uint64_t fl_bitmap;
+static uint32_t sl_bitmap[FL_INDEX_COUNT];
+static struct FreeBl *bins[FL_INDEX_COUNT][SL_INDEX_COUNT];
+
+/* Function: hdptr_of
+ *
+ * Parameters:
+ * plptr - pointer to the payload
+ *
+ * Returns:
+ * pointer to the header
+ *
+ * This function returns a pointer to the header of given payload.
+ */
+void *hdptr_of(void *plptr) {
+    return (char *)plptr - ALIGNMENT;
+}
+
+/* Function: plptr_of
+ *
+ * Parameters:
+ * hdptr - pointer to the header
+ *
+ * Returns:
+ * pointer to the payload
+ *
+ * This function returns a pointer to the payload of given header.
+ */
+void *plptr_of(void *hdptr) {
+    return (char *)hdptr + ALIGNMENT;
+}
+
+/* Function: isfree
+ *
+ * Parameters:
+ * hdptr - pointer to the header of a block
+ *
+ * Returns:
+ * whether the block is free
+ *
+ * This function returns whether the given block is free.
+ */
+bool isfree(void *hdptr) {
+    return ((*(size_t *)hdptr) & ALLOC_BIT) == 0;
+}
+
+/* Function: isprevfree
+ *
+ * Parameters:
+ * hdptr - pointer to the header of a block
+ *
+ * Returns:
+ * whether the block right before it in the heap is free
+ *
+ * This function returns whether the left neighbour of the given block is free.
+ */
+bool isprevfree(void *hdptr) {
+    return ((*(size_t *)hdptr) & PREV_FREE_BIT) != 0;
+}
+
+/* Function: get_pl_size
+ *
+ * Parameters:
+ * hdptr - pointer to the header of a block
+ *
+ * Returns:
+ * the block's payload size
+ *
+ * This function returns the block's payload size.
+ */
+size_t get_pl_size(void *hdptr) {
+    return *(size_t *)hdptr & ~(size_t)FLAG_BITS;
+}
+
+/* Function: set_header
+ *
+ * Parameters:
+ * hdptr - pointer to the header of a block
+ * pl_size - payload size
+ * flags - ALLOC_BIT and/or PREV_FREE_BIT
+ *
+ * This function writes the header of a block.
+ */
+void set_header(void *hdptr, size_t pl_size, size_t flags) {
+    *(size_t *)hdptr = pl_size | flags;
+}
+
+/* Function: get_next_hdptr
+ *
+ * Parameters:
+ * cur_hdptr - pointer to the current header
+ *
+ * Returns:
+ * pointer to the next header
+ *
+ * This function returns a pointer to the next header in the heap.
+ */
+void *get_next_hdptr(void *cur_hdptr) {
+    return (char *)cur_hdptr + ALIGNMENT + get_pl_size(cur_hdptr);
+}
+
+/* Function: get_prev_hdptr
+ *
+ * Parameters:
+ * cur_hdptr - pointer to the current header, whose left neighbour is free
+ *
+ * Returns:
+ * pointer to the previous header
+ *
+ * This function reads the footer of the free block to the left of the
+ * given block and returns a pointer to that block's header.
+ */
+void *get_prev_hdptr(void *cur_hdptr) {
+    size_t prev_pl_size = *((size_t *)cur_hdptr - 1);
+    return (char *)cur_hdptr - prev_pl_size - ALIGNMENT;
+}
+
+/* Function: set_prev_free
+ *
+ * Parameters:
+ * hdptr - pointer to the header of a block
+ * prev_free - whether the left neighbour of the block is free
+ *
+ * This function updates the prev-free bit of a block.
+ */
+void set_prev_free(void *hdptr, bool prev_free) {
+    if (prev_free) {
+        *(size_t *)hdptr |= PREV_FREE_BIT;
+    }
+    else {
+        *(size_t *)hdptr &= ~(size_t)PREV_FREE_BIT;
+    }
+}
+
+/* Function: roundup_bl
+ *
+ * Parameters:
+ * sz - size to be rounded up
+ * mult - rounding multiple
+ *
+ * Returns:
+ * the rounded size
+ *
+ * This function rounds up the block size to the given multiple.
+ * If the size is smaller than the minimum free block payload,
+ * roundup to the minimum size.
+ */
+size_t roundup_bl(size_t sz, size_t mult) {
+    if (sz <= MIN_PL_SIZE) {
+        return MIN_PL_SIZE;
+    }
+    return (sz + mult - 1) & ~(mult - 1);
+}
+
+/* Function: floor_log2
+ *
+ * Parameters:
+ * n - a nonzero number
+ *
+ * Returns:
+ * the index of the most significant set bit
+ *
+ * This function returns floor(log2(n)).
+ */
+int floor_log2(size_t n) {
+    return 63 - __builtin_clzl(n);
+}
+
+/* Function: mapping_insert
+ *
+ * Parameters:
+ * pl_size - payload size of a free block
+ * flp - where to store the first-level index
+ * slp - where to store the second-level index
+ *
+ * This function computes the bin that a free block of the given
+ * size belongs to.
+ */
+void mapping_insert(size_t pl_size, int *flp, int *slp) {
+    if (pl_size < SMALL_BLOCK_SIZE) {
+        *flp = 0;
+        *slp = pl_size / (SMALL_BLOCK_SIZE / SL_INDEX_COUNT);
+    }
+    else {
+        int fl = floor_log2(pl_size);
+        *slp = (pl_size >> (fl - SL_INDEX_LOG2)) ^ SL_INDEX_COUNT;
+        *flp = fl - (FL_INDEX_SHIFT - 1);
+    }
+}
+
+/* Function: search_size
+ *
+ * Parameters:
+ * needed_size - payload size that must be satisfied
+ *
+ * Returns:
+ * the size rounded up to the next bin boundary
+ *
+ * This function returns the smallest size whose bin holds only blocks
+ * of at least needed_size bytes.
+ */
+size_t search_size(size_t needed_size) {
+    if (needed_size >= SMALL_BLOCK_SIZE) {
+        needed_size += (1UL << (floor_log2(needed_size) - SL_INDEX_LOG2)) - 1;
+    }
+    return needed_size;
+}
+
+/* Function: mapping_search
+ *
+ * Parameters:
+ * needed_size - payload size that must be satisfied
+ * flp - where to store the first-level index
+ * slp - where to store the second-level index
+ *
+ * This function computes the first bin whose blocks are all at least
+ * needed_size bytes, by rounding the size up to the next bin boundary.
+ */
+void mapping_search(size_t needed_size, int *flp, int *slp) {
+    mapping_insert(search_size(needed_size), flp, slp);
+}
+
+/* Function: insert_free_bl
+ *
+ * Parameters:
+ * hd - pointer to the header of a free block
+ *
+ * This function writes the footer of a free block and pushes it on the
+ * front of its bin, marking the bin as non-empty in both bitmaps.
+ */
+void insert_free_bl(void *hd) {
+    size_t pl_size = get_pl_size(hd);
+    int fl, sl;
+    mapping_insert(pl_size, &fl, &sl);
+
+    *(size_t *)((char *)plptr_of(hd) + pl_size - sizeof(size_t)) = pl_size;
+
+    struct FreeBl *cur_bl = plptr_of(hd);
+    cur_bl->prev = NULL;
+    cur_bl->next = bins[fl][sl];
+    if (cur_bl->next != NULL) {
+        cur_bl->next->prev = cur_bl;
+    }
+    bins[fl][sl] = cur_bl;
+    fl_bitmap |= 1UL << fl;
+    sl_bitmap[fl] |= 1U << sl;
+}
+
+/* Function: remove_free_bl
+ *
+ * Parameters:
+ * hd - pointer to the header of a free block
+ *
+ * This function unlinks a free block from its bin, clearing the bitmap
+ * bits if the bin becomes empty.
+ */
+void remove_free_bl(void *hd) {
+    int fl, sl;
+    mapping_insert(get_pl_size(hd), &fl, &sl);
+
+    struct FreeBl *cur_bl = plptr_of(hd);
+    if (cur_bl->prev != NULL) {
+        cur_bl->prev->next = cur_bl->next;
+    }
+    else {
+        bins[fl][sl] = cur_bl->next;
+        if (bins[fl][sl] == NULL) {
+            sl_bitmap[fl] &= ~(1U << sl);
+            if (sl_bitmap[fl] == 0) {
+                fl_bitmap &= ~(1UL << fl);
+            }
+        }
+    }
+    if (cur_bl->next != NULL) {
+        cur_bl->next->prev = cur_bl->prev;
+    }
+}
+
+/* Function: find_free_bl
+ *
+ * Parameters:
+ * needed_size - needed payload size
+ *
+ * Returns:
+ * pointer to the header of a free block of at least needed_size bytes,
+ * or NULL if there is none
+ *
+ * This function looks for a non-empty bin at or above the bin for the
+ * needed size, first within the same first-level class and then in the
+ * next non-empty first-level class.
+ */
+void *find_free_bl(size_t needed_size) {
+    int fl, sl;
+    mapping_search(needed_size, &fl, &sl);
+    if (fl >= FL_INDEX_COUNT) {
+        return NULL;
+    }
+
+    uint32_t sl_map = sl_bitmap[fl] & (~0U << sl);
+    if (sl_map == 0) {
+        uint64_t fl_map = fl_bitmap & (~0UL << (fl + 1));
+        if (fl + 1 >= FL_INDEX_COUNT || fl_map == 0) {
+            return NULL;
+        }
+        fl = __builtin_ctzl(fl_map);
+        sl_map = sl_bitmap[fl];
+    }
+    sl = __builtin_ctz(sl_map);
+    return hdptr_of(bins[fl][sl]);
+}
+
+/* Function: split_bl
+ *
+ * Parameters:
+ * hd - pointer to the header of an allocated block
+ * needed_size - payload size the block should keep
+ *
+ * This function trims an allocated block down to needed_size if the
+ * remainder is big enough to be a free block of its own. The remainder
+ * is merged with its right neighbour if that one is free.
+ */
+void split_bl(void *hd, size_t needed_size) {
+    size_t pl_size = get_pl_size(hd);
+    if (pl_size - needed_size < ALIGNMENT + MIN_PL_SIZE) {
+        return;
+    }
+
+    set_header(hd, needed_size, ALLOC_BIT | (*(size_t *)hd & PREV_FREE_BIT));
+    void *rest_hd = get_next_hdptr(hd);
+    size_t rest_size = pl_size - needed_size - ALIGNMENT;
+    void *next_hd = (char *)rest_hd + ALIGNMENT + rest_size;
+    if (isfree(next_hd)) {
+        remove_free_bl(next_hd);
+        rest_size += ALIGNMENT + get_pl_size(next_hd);
+    }
+    set_header(rest_hd, rest_size, 0);
+    insert_free_bl(rest_hd);
+    set_prev_free(get_next_hdptr(rest_hd), true);
+}
+
+/* Function: myinit
+ *
+ * Parameters:
+ * heap_start - pointer to the start of heap
+ * heap_size - size of heap
+ *
+ * Returns:
+ * if the initialization was successful
+ *
+ * This function is called before making any allocation
+ * requests. It returns true if initialization was
+ * successful, or false otherwise. The myinit function can be
+ * called to reset the heap to an empty state. When running
+ * against a set of of test scripts, the test harness calls
+ * myinit before starting each new script.
+ */
+bool myinit(void *heap_start, size_t heap_size) {
+    heap_size &= ~(size_t)(ALIGNMENT - 1);
+    //the bins can't index a free block of 2^FL_INDEX_MAX bytes or more
+    if (heap_size >= (1UL << FL_INDEX_MAX)) {
+        heap_size = (1UL << FL_INDEX_MAX) - ALIGNMENT;
+    }
+    if (heap_size < 2 * ALIGNMENT + MIN_PL_SIZE) {
+        //commit enough of the segment for one free block and the sentinel
+        void *end = (char *)heap_start + heap_size;
+        if (extend_heap_segment(2 * ALIGNMENT + MIN_PL_SIZE - heap_size) != end) {
+            return false;
+        }
+        heap_size = (char *)heap_segment_start() + heap_segment_size() - (char *)heap_start;
+    }
+
+    first_hd = heap_start;
+    total_size = heap_size;
+    fl_bitmap = 0;
+    memset(sl_bitmap, 0, sizeof(sl_bitmap));
+    memset(bins, 0, sizeof(bins));
+
+    sentinel_hd = (char *)first_hd + total_size - ALIGNMENT;
+    set_header(first_hd, total_size - 2 * ALIGNMENT, 0);
+    insert_free_bl(first_hd);
+    set_header(sentinel_hd, 0, ALLOC_BIT | PREV_FREE_BIT);
+    return true;
+}
+
+/* Function: extend_heap
+ *
+ * Parameters:
+ * needed_size - payload size the heap must be able to hold at its end
+ *
+ * Returns:
+ * whether the heap could grow
+ *
+ * This function commits more of the heap segment right after the end of
+ * the heap, at least HEAP_EXTEND_MIN bytes, and turns it into a free
+ * block that starts at the old sentinel, or at the last block if that one
+ * is free. The block is big enough to land in a bin that a search for
+ * needed_size looks at. A new sentinel ends the heap.
+ */
+bool extend_heap(size_t needed_size) {
+    void *end = (char *)first_hd + total_size;
+    void *last_hd = sentinel_hd;
+    size_t last_size = 0;
+    if (isprevfree(sentinel_hd)) {
+        last_hd = get_prev_hdptr(sentinel_hd);
+        last_size = ALIGNMENT + get_pl_size(last_hd);
+    }
+
+    size_t grow = ALIGNMENT + search_size(needed_size) - last_size;
+    if (grow < HEAP_EXTEND_MIN) {
+        grow = HEAP_EXTEND_MIN;
+    }
+    if (total_size + grow >= (1UL << FL_INDEX_MAX)) {
+        return false;
+    }
+    //the new memory is only usable if it continues this heap
+    if (extend_heap_segment(grow) != end) {
+        return false;
+    }
+    total_size = (char *)heap_segment_start() + heap_segment_size() - (char *)first_hd;
+
+    if (last_hd != sentinel_hd) {
+        remove_free_bl(last_hd);
+    }
+    sentinel_hd = (char *)first_hd + total_size - ALIGNMENT;
+    set_header(last_hd, (char *)sentinel_hd - (char *)last_hd - ALIGNMENT, 0);
+    insert_free_bl(last_hd);
+    set_header(sentinel_hd, 0, ALLOC_BIT | PREV_FREE_BIT);
+    return true;
+}
+
+/* Function: mymalloc
+ *
+ * Parameters:
+ * requested_size - requested size to be allocated
+ *
+ * Returns:
+ * pointer to the payload of the block that the requested size can fit in
+ *
+ * This function takes a block from the first non-empty bin whose blocks
+ * are all large enough, splits off the unused tail and returns a pointer
+ * to its payload. If no bin has a block that fits, the heap is extended.
+ */
+void *mymalloc(size_t requested_size) {
+    if (requested_size == 0 || requested_size > MAX_REQUEST_SIZE) {
+        return NULL;
+    }
+    size_t needed_size = roundup_bl(requested_size, ALIGNMENT);
+    void *hd = find_free_bl(needed_size);
+    if (hd == NULL) {
+        if (!extend_heap(needed_size) || (hd = find_free_bl(needed_size)) == NULL) {
+            return NULL;
+        }
+    }
+
+    remove_free_bl(hd);
+    set_header(hd, get_pl_size(hd), ALLOC_BIT | (*(size_t *)hd & PREV_FREE_BIT));
+    set_prev_free(get_next_hdptr(hd), false);
+    split_bl(hd, needed_size);
+    return plptr_of(hd);
+}
+
+/* Function: myfree
+ *
+ * Parameters:
+ * ptr - pointer to the payload to be freed
+ *
+ * This function frees a previously allocated block, merging it with
+ * both of its neighbours if they are free.
+ */
+void myfree(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    void *hd = hdptr_of(ptr);
+    if (isfree(hd)) {
+        return;
+    }
+
+    size_t pl_size = get_pl_size(hd);
+    void *next_hd = get_next_hdptr(hd);
+    if (isfree(next_hd)) {
+        remove_free_bl(next_hd);
+        pl_size += ALIGNMENT + get_pl_size(next_hd);
+    }
+    if (isprevfree(hd)) {
+        void *prev_hd = get_prev_hdptr(hd);
+        remove_free_bl(prev_hd);
+        pl_size += ALIGNMENT + get_pl_size(prev_hd);
+        hd = prev_hd;
+    }
+
+    set_header(hd, pl_size, 0);
+    insert_free_bl(hd);
+    set_prev_free(get_next_hdptr(hd), true);
+}
+
+/* Function: myrealloc
+ *
+ * Parameters:
+ * old_ptr - pointer to the payload to be reallocated
+ * new_size - the new size requested
+ *
+ * This function reallocates a previously allocated block. It shrinks in
+ * place, grows in place into a free right neighbour when that is big
+ * enough, and otherwise moves the payload to a new block.
+ */
+void *myrealloc(void *old_ptr, size_t new_size) {
+    if (old_ptr == NULL) {
+        return mymalloc(new_size);
+    }
+    else if (new_size == 0) {
+        myfree(old_ptr);
+        return NULL;
+    }
+    else if (new_size > MAX_REQUEST_SIZE) {
+        return NULL;
+    }
+
+    size_t needed_size = roundup_bl(new_size, ALIGNMENT);
+    void *hd = hdptr_of(old_ptr);
+    size_t old_size = get_pl_size(hd);
+    if (needed_size <= old_size) {
+        split_bl(hd, needed_size);
+        return old_ptr;
+    }
+
+    void *next_hd = get_next_hdptr(hd);
+    if (isfree(next_hd)
+        && old_size + ALIGNMENT + get_pl_size(next_hd) >= needed_size) {
+        remove_free_bl(next_hd);
+        size_t combined_size = old_size + ALIGNMENT + get_pl_size(next_hd);
+        set_header(hd, combined_size, ALLOC_BIT | (*(size_t *)hd & PREV_FREE_BIT));
+        set_prev_free(get_next_hdptr(hd), false);
+        split_bl(hd, needed_size);
+        return old_ptr;
+    }
+
+    void *new_ptr = mymalloc(new_size);
+    if (new_ptr != NULL) {
+        memcpy(new_ptr, old_ptr, old_size);
+        myfree(old_ptr);
+    }
+    return new_ptr;
+}
+
+/* Function: mytrim
+ *
+ * Returns: 
+ * number of bytes given back to the OS
+ *
+ * This function releases the whole pages between the links and the
+ * footer of every free block of at least TRIM_MIN_SIZE bytes with
+ * madvise. Those blocks are exactly the ones in the first-level classes
+ * from TRIM_MIN_SIZE up, so the small bins are never looked at.
+ */
+size_t mytrim() {
+    size_t released = 0;
+    int min_fl, min_sl;
+    mapping_insert(TRIM_MIN_SIZE, &min_fl, &min_sl);
+    uint64_t fl_map = fl_bitmap & (~0UL << min_fl);
+    while (fl_map != 0) {
+        int fl = __builtin_ctzl(fl_map);
+        fl_map &= fl_map - 1;
+        for (int sl = 0; sl < SL_INDEX_COUNT; sl++) {
+            for (struct FreeBl *cur = bins[fl][sl]; cur != NULL; cur = cur->next) {
+                uintptr_t start = ((uintptr_t)(cur + 1) + PAGE_SIZE - 1) & ~(uintptr_t)(PAGE_SIZE - 1);
+                uintptr_t end = ((uintptr_t)cur + get_pl_size(hdptr_of(cur)) - sizeof(size_t))
+                                & ~(uintptr_t)(PAGE_SIZE - 1);
+                if (end > start && madvise((void *)start, end - start, MADV_DONTNEED) == 0) {
+                    released += end - start;
+                }
+            }
+        }
+    }
+    return released;
+}
+
+/* Function: myheap_stats
+ *
+ * Parameters:
+ * stats - where to store the snapshot
+ *
+ * This function walks the heap to fill in the snapshot.
+ */
+void myheap_stats(struct heap_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->heap_bytes = total_size;
+    for (void *hd = first_hd; hd != sentinel_hd; hd = get_next_hdptr(hd)) {
+        size_t pl_size = get_pl_size(hd);
+        if (!isfree(hd)) {
+            stats->live_bytes += pl_size;
+            stats->live_blocks++;
+            continue;
+        }
+        int bucket = 63 - __builtin_clzl(pl_size);
+        stats->free_histogram[bucket < HEAP_STATS_BUCKETS ? bucket : HEAP_STATS_BUCKETS - 1]++;
+        stats->free_bytes += pl_size;
+        stats->free_blocks++;
+        if (pl_size > stats->largest_free) {
+            stats->largest_free = pl_size;
+        }
+    }
+    if (stats->free_bytes > 0) {
+        stats->fragmentation = 1.0 - (double)stats->largest_free / stats->free_bytes;
+    }
+}
+
+/* Function: validate_heap
+ *
+ * Return true if all is ok, or false otherwise.
+ * This function is called periodically by the test
+ * harness to check the state of the heap allocator.
+ * It walks the heap once to check block sizes, flags, footers and
+ * coalescing, then walks every bin to check that each free block is in
+ * the bin its size maps to and that the bitmaps match the bins.
+ */
+bool validate_heap() {
+    void *hd = first_hd;
+    size_t nfree = 0;
+    bool prev_free = false;
+
+    while (hd != sentinel_hd) {
+        if ((char *)hd > (char *)sentinel_hd) {
+            printf("Block at address %p runs past the end of the heap.\n", hd);
+            breakpoint();
+            return false;
+        }
+        if (isprevfree(hd) != prev_free) {
+            printf("Block at address %p has a wrong prev-free bit.\n", hd);
+            breakpoint();
+            return false;
+        }
+        size_t pl_size = get_pl_size(hd);
+        if (pl_size < MIN_PL_SIZE || pl_size % ALIGNMENT != 0) {
+            printf("Block at address %p has incorrect payload size.\n", hd);
+            breakpoint();
+            return false;
+        }
+        if (isfree(hd)) {
+            if (prev_free) {
+                printf("Free blocks at address %p and before it were not coalesced.\n", hd);
+                breakpoint();
+                return false;
+            }
+            if (*(size_t *)((char *)get_next_hdptr(hd) - sizeof(size_t)) != pl_size) {
+                printf("Free block at address %p has a footer that doesn't match its header.\n", hd);
+                breakpoint();
+                return false;
+            }
+            nfree++;
+        }
+        prev_free = isfree(hd);
+        hd = get_next_hdptr(hd);
+    }
+    if (isprevfree(sentinel_hd) != prev_free) {
+        printf("Heap sentinel has a wrong prev-free bit.\n");
+        breakpoint();
+        return false;
+    }
+
+    size_t nlisted = 0;
+    for (int fl = 0; fl < FL_INDEX_COUNT; fl++) {
+        if (((fl_bitmap >> fl) & 1) != (sl_bitmap[fl] != 0)) {
+            printf("First-level bitmap doesn't match second-level bitmap %d.\n", fl);
+            breakpoint();
+            return false;
+        }
+        for (int sl = 0; sl < SL_INDEX_COUNT; sl++) {
+            if (((sl_bitmap[fl] >> sl) & 1) != (bins[fl][sl] != NULL)) {
+                printf("Second-level bitmap doesn't match bin [%d][%d].\n", fl, sl);
+                breakpoint();
+                return false;
+            }
+            for (struct FreeBl *cur_bl = bins[fl][sl]; cur_bl != NULL; cur_bl = cur_bl->next) {
+                void *cur_hd = hdptr_of(cur_bl);
+                int cur_fl, cur_sl;
+                if (!isfree(cur_hd)) {
+                    printf("Block at address %p is in a bin but not marked as free.\n", cur_hd);
+                    breakpoint();
+                    return false;
+                }
+                mapping_insert(get_pl_size(cur_hd), &cur_fl, &cur_sl);
+                if (cur_fl != fl || cur_sl != sl) {
+                    printf("Free block at address %p is in the wrong bin.\n", cur_hd);
+                    breakpoint();
+                    return false;
+                }
+                if (++nlisted > nfree) {
+                    printf("Bins hold more blocks than the heap has free blocks.\n");
+                    breakpoint();
+                    return false;
+                }
+            }
+        }
+    }
+    if (nlisted != nfree) {
+        printf("Count of binned blocks doesn't match the count of free blocks.\n");
+        breakpoint();
+        return false;
+    }
+    return true;
+}
+
+/* Function: dump_heap
+ *
+ * This function traverses the heap and prints out information about each block.
+ */
+void dump_heap() {
+    printf("Heap segment starts at address %p, ends at %p.",
+           first_hd, (char *)first_hd + total_size);
+    for (void *cur = first_hd; cur != sentinel_hd; cur = get_next_hdptr(cur)) {
+        printf("\n%p: %lu %s", cur, get_pl_size(cur), isfree(cur) ? "free" : "used");
+    }
+    printf("\nNon-empty bins are below:");
+    for (int fl = 0; fl < FL_INDEX_COUNT; fl++) {
+        for (int sl = 0; sl < SL_INDEX_COUNT; sl++) {
+            if (bins[fl][sl] != NULL) {
+                printf("\n[%d][%d]:", fl, sl);
+                for (struct FreeBl *cur_bl = bins[fl][sl]; cur_bl != NULL; cur_bl = cur_bl->next) {
+                    printf(" %p", cur_bl);
+                }
+            }
+        }
+    }
+    printf("\n");
+}
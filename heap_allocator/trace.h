@@ -0,0 +1,103 @@
+/* File: trace.h
+ * -------------
+ * The packed binary trace format, a compact stand-in for the text scripts
+ * read by test_harness. pack_script converts a script into a trace and
+ * test_harness maps a trace straight into memory and decodes each request
+ * as it replays it, so loading a trace costs nothing however long it is.
+ *
+ * A trace is a trace_header_t followed by one record per request:
+ *  -- a tag byte holding the request type (ALLOC, FREE or REALLOC, the
+ *     same values as in test_harness)
+ *  -- the block id as a varint of the zigzag-encoded difference from the
+ *     id of the previous request, since scripts tend to reuse nearby ids
+ *  -- for ALLOC and REALLOC, the size as a varint
+ * Varints hold 7 bits per byte, low bits first, with the top bit set on
+ * every byte but the last. The header is copied in and out as a struct,
+ * so its fields are in host byte order, and only little-endian hosts are
+ * supported so that a trace reads the same on every machine that can
+ * replay it.
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+#include <stdbool.h> // for bool
+#include <stdint.h> // for uint8_t, uint32_t, uint64_t
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "trace headers are stored in host byte order, which must be little-endian"
+#endif
+
+// first bytes of every trace, to tell it apart from a text script
+#define TRACE_MAGIC "HEAPTRC1"
+#define TRACE_MAGIC_LEN 8
+
+// request types in a record's tag byte
+#define TRACE_ALLOC 1
+#define TRACE_FREE 2
+#define TRACE_REALLOC 3
+
+// a varint of a 64-bit value takes at most this many bytes
+#define TRACE_MAX_VARINT 10
+
+// struct for the header at the start of a trace
+typedef struct {
+    char magic[TRACE_MAGIC_LEN];
+    uint64_t num_ops;       // number of records that follow
+    uint64_t counts[3];     // records of each type, indexed by type - TRACE_ALLOC
+    uint32_t num_ids;       // one more than the largest block id
+    uint32_t reserved;
+} trace_header_t;
+
+/* Function: trace_put_varint
+ * --------------------------
+ * Writes value as a varint at out and returns the number of bytes written.
+ */
+static inline int trace_put_varint(uint8_t *out, uint64_t value) {
+    int n = 0;
+    while (value >= 0x80) {
+        out[n++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    out[n++] = value;
+    return n;
+}
+
+/* Function: trace_get_varint
+ * --------------------------
+ * Reads a varint at *pcursor into *pvalue and advances *pcursor past it.
+ * Returns false, leaving *pcursor alone, if the varint runs past end or
+ * is longer than TRACE_MAX_VARINT bytes.
+ */
+static inline bool trace_get_varint(const uint8_t **pcursor, const uint8_t *end,
+    uint64_t *pvalue) {
+    const uint8_t *p = *pcursor;
+    uint64_t value = 0;
+    for (int shift = 0; p < end && shift < 7 * TRACE_MAX_VARINT; shift += 7) {
+        value |= (uint64_t)(*p & 0x7f) << shift;
+        if ((*p++ & 0x80) == 0) {
+            *pcursor = p;
+            *pvalue = value;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Function: trace_put_record
+ * --------------------------
+ * Encodes one request at out, given the id of the previous request, and
+ * returns the number of bytes written (at most 1 + 2 * TRACE_MAX_VARINT).
+ */
+static inline int trace_put_record(uint8_t *out, int op, int id, int prev_id,
+    uint64_t size) {
+    int64_t delta = (int64_t)id - prev_id;
+    int n = 0;
+    out[n++] = op;
+    n += trace_put_varint(out + n, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+    if (op != TRACE_FREE) {
+        n += trace_put_varint(out + n, size);
+    }
+    return n;
+}
+
+#endif